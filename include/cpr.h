@@ -10,6 +10,12 @@ extern "C"
                           int fflag,
                           double *out_lat, double *out_lon);
 
+    unsigned decode_cpr_airborne_batch(unsigned count,
+                                       const int *even_cprlat, const int *even_cprlon,
+                                       const int *odd_cprlat, const int *odd_cprlon,
+                                       const int *fflag,
+                                       double *out_lat, double *out_lon, int *status);
+
     int decode_cpr_surface(double reflat, double reflon,
                          int even_cprlat, int even_cprlon,
                          int odd_cprlat, int odd_cprlon,
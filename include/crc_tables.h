@@ -0,0 +1,36 @@
+#ifndef __CRC_TABLES_H
+#define __CRC_TABLES_H
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include "crc.h"
+
+    // Error-correction tables, generated at build time by crc_gen.
+    //
+    // Each table is a cuckoo hash: every syndrome lives in one of two slots,
+    // so a lookup is at most two probes. Syndrome 0 is never stored (it means
+    // "no errors") and marks an empty slot.
+    struct syndrome_hash
+    {
+        const struct errorinfo *slots;
+        unsigned bits;  // log2 of the number of slots
+        uint32_t seed1; // multipliers for the two slot choices
+        uint32_t seed2;
+    };
+
+    // Indexed by [bits to correct - 1][0: 56-bit, 1: 112-bit messages]
+    extern const struct syndrome_hash crc_error_tables[MODES_MAX_BITERRORS][2];
+
+    // Multiplicative hashing: the top 'bits' bits of syndrome * seed
+    static inline uint32_t syndrome_slot(uint32_t syndrome, uint32_t seed, unsigned bits)
+    {
+        return (syndrome * seed) >> (32 - bits);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __CRC_TABLES_H */
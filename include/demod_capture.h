@@ -0,0 +1,50 @@
+#ifndef __DEMOD_CAPTURE_H
+#define __DEMOD_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+    // Diagnostic capture of rejected Mode S candidates.
+    //
+    // The demodulator offers every rejected candidate to a fixed-size ring; one
+    // in every 'rate' offers is kept, overwriting the oldest record when the ring
+    // is full. The demodulator never waits on the ring: if a reader holds the lock
+    // the record is simply dropped. Callers check lib_state.config.demod_capture_size
+    // before calling demod_capture_add() so a disabled capture costs one branch.
+    //
+    // readsb_demod_capture_dump() appends records to a file, each one being
+    // (all fields little-endian):
+    //
+    //   offset size
+    //        0    4  magic "RSBC"
+    //        4    1  format version (1)
+    //        5    1  phase tried (int8, -1 if none)
+    //        6    2  score (int16, see score_modes_message / decode_modes_message)
+    //        8    4  sample rate, Hz
+    //       12    8  timestamp of the first sample, 12MHz clock
+    //       20   14  sliced message bytes
+    //       34    2  number of magnitude samples N
+    //       36   2N  magnitude samples (uint16)
+
+    // Allocate the ring. Not threadsafe. Returns true on success.
+    //
+    //   size   - number of records to keep
+    //   rate   - keep one in every 'rate' rejected candidates (0 is treated as 1)
+    //   window - number of magnitude samples stored per record
+    bool demod_capture_init(unsigned size, unsigned rate, unsigned window);
+
+    // Free the ring. Not threadsafe.
+    void demod_capture_destroy();
+
+    // Offer a rejected candidate. 'm' must have at least 'window' samples.
+    void demod_capture_add(const uint16_t *m, uint64_t timestamp, int phase, const unsigned char *msg, int score);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __DEMOD_CAPTURE_H */
@@ -0,0 +1,15 @@
+#ifndef __DEMOD_HIRATE_H
+#define __DEMOD_HIRATE_H
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct mag_buf;
+
+    void demodulate_hirate(struct mag_buf *mag);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __DEMOD_HIRATE_H */
@@ -48,6 +48,7 @@ extern "C"
 
         uint64_t sampleTimestamp; // Clock timestamp of the start of this block, 12MHz clock
         uint64_t sysTimestamp;    // Estimated system time at start of block
+        uint64_t readyTimestamp;  // ustime() when the block was enqueued, 0 if unknown
 
         mag_buf_flags flags; // bitwise flags for this buffer
         double mean_level;   // Mean of normalized (0..1) signal level
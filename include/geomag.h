@@ -6,7 +6,11 @@ extern "C"
 #endif
 
     int geomag_init();
+    void geomag_destroy();
+    double geomag_decimal_year();
     int geomag_calc(double alt, double lat, double lon, double decimal_year, double *dec, double *dip, double *ti, double *gv);
+    int geomag_calc_declinations(unsigned count, const double *alt, const double *lat, const double *lon, double decimal_year, double *dec);
+    int geomag_declination(double alt, double lat, double lon, double *dec);
 
 #ifdef __cplusplus
 }
@@ -6,17 +6,39 @@ extern "C"
 {
 #endif
 
+#include <stdbool.h>
 #include <stdint.h>
 
-    // Call once:
-    void icao_filter_init();
+    struct aircraft;
 
-    // Add an address to the filter
+    // The filter may be tested, added to and expired from any number of
+    // threads at once; icao_filter_test() never blocks.
+    // init and destroy must not run concurrently with anything else.
+
+    // Call once. Returns false if out of memory.
+    bool icao_filter_init();
+
+    // Free the filter tables.
+    void icao_filter_destroy();
+
+    // Add an address to the filter. The filter grows as needed.
     void icao_filter_add(uint32_t addr);
 
     // Test if the given address matches the filter
     int icao_filter_test(uint32_t addr);
 
+    // As icao_filter_test(), also returning the aircraft registered for the
+    // address with icao_filter_set_aircraft() (NULL if none). The handle is
+    // a hint: it may belong to another address, so check a->addr. It stays
+    // valid only until the tracker next removes aircraft, so use it on the
+    // thread that does the tracking.
+    int icao_filter_lookup(uint32_t addr, struct aircraft **aircraft);
+
+    // Register the tracked aircraft for an address, or NULL before the
+    // aircraft is freed. Does nothing if the address is not in the filter;
+    // registering takes no lock unless a handle actually changes.
+    void icao_filter_set_aircraft(uint32_t addr, struct aircraft *aircraft);
+
     // Test if the top 16 bits match any previously added address.
     // If they do, returns an arbitrary one of the matched
     // addresses. Returns 0 on failure.
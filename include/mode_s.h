@@ -82,9 +82,22 @@ extern "C"
         }
     }
 
+    // Checksum work done by score_modes_message(), handed to
+    // decode_modes_message() so that an accepted candidate is not
+    // checksummed, diagnosed and filtered a second time.
+    // Only meaningful if the score was >= 0.
+    typedef struct
+    {
+        uint32_t crc;               // CRC syndrome of the message as received
+        const struct errorinfo *ei; // error correction to apply (DF11/17/18), else NULL
+        uint32_t addr;              // ICAO address: the corrected AA, or the CRC-derived address
+        int filter_hit;             // icao_filter_test(addr)
+        struct aircraft *aircraft;  // tracked aircraft for addr, a hint (see icao_filter_lookup)
+    } modes_score_t;
+
     int modes_message_len_by_type(int type);
-    int score_modes_message(unsigned char *msg, int validbits);
-    int decode_modes_message(modes_message_t *mm, unsigned char *msg);
+    int score_modes_message(unsigned char *msg, int validbits, modes_score_t *result);
+    int decode_modes_message(modes_message_t *mm, unsigned char *msg, const modes_score_t *score);
     void use_modes_message(modes_message_t *mm);
 
 #ifdef __cplusplus
@@ -0,0 +1,53 @@
+#ifndef __POOL_H
+#define __POOL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+    // Fixed-size object pool.
+    //
+    // Objects are carved out of slabs of 'per_slab' objects, each rounded up
+    // to a whole number of cache lines, and recycled through a LIFO freelist
+    // so the most recently released (still cached) object is handed out
+    // first. Slabs are only returned to the system by pool_destroy(): the
+    // memory held is bounded by the high-water mark and the heap never sees
+    // the churn of short-lived objects. Not threadsafe.
+
+    struct pool_slab;
+
+    struct pool
+    {
+        size_t size;              // object size, rounded up to a cache line
+        unsigned per_slab;        // objects per slab
+        void *free;               // freelist, linked through the first word of each object
+        struct pool_slab *slabs;  // all slabs, newest first
+        uint32_t allocated;       // objects in all slabs
+        uint32_t used;            // objects handed out
+        uint32_t high_water;      // highest value of 'used' seen
+    };
+
+    // Set up a pool of objects of 'size' bytes, allocating slabs of 'per_slab'
+    // objects. At least 'prealloc' objects are allocated up front.
+    // Returns true on success.
+    bool pool_init(struct pool *p, size_t size, unsigned per_slab, unsigned prealloc);
+
+    // Free all slabs. Every object handed out by the pool becomes invalid.
+    void pool_destroy(struct pool *p);
+
+    // Return an uninitialized object, or NULL if a new slab was needed and
+    // could not be allocated.
+    void *pool_alloc(struct pool *p);
+
+    // Give an object back to the pool.
+    void pool_free(struct pool *p, void *obj);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __POOL_H */
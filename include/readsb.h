@@ -37,6 +37,13 @@ extern "C"
         uint8_t nfix_crc;   // Number of crc bit error(s) to correct
         uint8_t mode_ac;    // Enable decoding of SSR Modes A & C
         uint8_t dc_filter;  // Should we apply a DC filter?
+        uint32_t sample_rate; // Magnitude sample rate in Hz (0 = 2.4MHz, or a multiple of 2MHz from 6 to 24MHz)
+        uint8_t demod_overlap; // Look for stronger frames overlapping a decoded one (2.4MHz only)
+        uint16_t demod_capture_size; // Rejected candidates kept for diagnostics (0 = capture disabled)
+        uint16_t demod_capture_rate; // Capture one in every N rejected candidates
+        uint32_t aircraft_prealloc; // Aircraft records to allocate up front (0 = as needed)
+        uint32_t maintenance_budget; // Aircraft or Mode A/C codes handled per demodulated block (0 = all at once, from track_periodic_update)
+        uint32_t max_aircraft; // Most aircraft tracked at once, the least recently seen are evicted beyond that (0 = no limit)
     } readsb_config_t;
 
     /* RTL-SDR device configuration */
@@ -78,11 +85,57 @@ extern "C"
         int crc;
     } readsb_beastgns_config_t;
 
+    /* Decode pipeline stages measured by readsb_get_latency() */
+    enum latency_stage
+    {
+        LATENCY_BLOCK_TO_DEMOD = 0, // reader handing a block over -> demodulator starting on it
+        LATENCY_DEMOD_TO_DECODE,    // demodulator starting on a block -> message decoded
+        LATENCY_DECODE_TO_TRACK,    // message decoded -> aircraft updated
+        LATENCY_BLOCK,              // demodulator starting on a block -> block and its maintenance done
+        LATENCY_MAINTENANCE         // one run of the periodic tracking maintenance
+    };
+
+    /* Latency summary, in microseconds */
+    typedef struct
+    {
+        uint64_t count;
+        uint32_t mean;
+        uint32_t p50;
+        uint32_t p90;
+        uint32_t p99;
+        uint32_t max;
+    } readsb_latency_t;
+
+    /* Aircraft record pool usage */
+    typedef struct
+    {
+        uint32_t used;       // Records holding a tracked aircraft
+        uint32_t allocated;  // Records allocated, used or free
+        uint32_t high_water; // Most records used at once
+    } readsb_pool_stats_t;
+
+    /* Rejected demodulator candidate, see readsb_demod_capture_read() */
+    typedef struct
+    {
+        uint64_t timestamp; // Timestamp of the first sample, 12MHz clock
+        int score;          // Score of the candidate (-1 unknown ICAO, -2 bad)
+        int phase;          // Phase tried: 2.4MHz 4..8 in 1/5 sample, high rate 0..2 around the peak; -1 if none
+        uint8_t msg[14];    // Sliced message bytes
+        unsigned nsamples;  // Magnitude samples recorded for this candidate
+    } readsb_demod_capture_t;
+
     READSB_API enum error_no readsb_init(readsb_config_t *config);
     READSB_API enum error_no readsb_open(enum sdr_type sdr_type, void *config);
     READSB_API void readsb_close();
     READSB_API unsigned readsb_get_aircraft_count();
     READSB_API void *readsb_get_aircraft_by_address(unsigned addr);
+    READSB_API void readsb_get_aircraft_pool_stats(readsb_pool_stats_t *pool);
+    READSB_API enum error_no readsb_get_latency(enum latency_stage stage, readsb_latency_t *latency);
+    /* Pop the oldest captured candidate; up to max_samples magnitude samples are copied to samples.
+       Returns 1 if a record was read, 0 if there is none. */
+    READSB_API int readsb_demod_capture_read(readsb_demod_capture_t *rec, uint16_t *samples, unsigned max_samples);
+    /* Drain captured candidates, appending them to a file. Returns the number of records written or -1. */
+    READSB_API int readsb_demod_capture_dump(const char *path);
 
 #ifdef __cplusplus
 }
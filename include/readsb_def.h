@@ -11,6 +11,7 @@ extern "C"
 #include <stdatomic.h>
 #include <pthread.h>
 #include "stats.h"
+#include "pool.h"
 
 #define MODES_DEFAULT_FREQ 1090000000
 #define MODES_RTL_BUFFERS 16                           // Number of RTL buffers
@@ -50,7 +51,12 @@ extern "C"
 
 #define MODES_NON_ICAO_ADDRESS (1 << 24) // Set on addresses to indicate they are not ICAO addresses
 #define MODES_NOTUSED(V) ((void)V)
-#define AIRCRAFTS_BUCKETS 2048
+#define AIRCRAFTS_INITIAL_SIZE 1024 // initial aircraft table capacity, must be a power of two
+#define AIRCRAFTS_POOL_SLAB 64      // aircraft records allocated at a time
+#define AIRCRAFTS_WHEEL_BITS 6      // log2 of the timer wheel slots per level
+#define AIRCRAFTS_WHEEL_LEVELS 2    // timer wheel levels, the last one covers 2^(BITS*LEVELS) seconds
+#define AIRCRAFTS_PROBATION_BUCKETS 1024 // buckets of addresses heard once, must be a power of two
+#define AIRCRAFTS_PROBATION_WAYS 4       // addresses per probation bucket
 
     /* Where did a bit of data arrive from? In order of increasing priority */
     typedef enum
@@ -182,6 +188,7 @@ extern "C"
     {
         uint64_t timestampMsg;    // Timestamp of the message (12MHz clock)
         uint64_t sysTimestampMsg; // Timestamp of the message (system time)
+        uint64_t decodedUs;       // ustime() when the message was decoded, 0 if unknown
         // Generic fields
         unsigned char msg[MODES_LONG_MSG_BYTES];      // Binary message.
         unsigned char verbatim[MODES_LONG_MSG_BYTES]; // Binary message, as originally received before correction
@@ -190,6 +197,7 @@ extern "C"
         uint32_t crc;                                 // Message CRC
         int correctedbits;                            // No. of bits corrected
         uint32_t addr;                                // Address Announced
+        struct aircraft *aircraft;                    // Tracked aircraft found while scoring; a hint, may be NULL or stale
         addr_type_t addrtype;                         // address format / source
         int remote;                                   // If set this message is from a remote station
         int score;                                    // Scoring from scoreModesMessage, if used
@@ -394,6 +402,39 @@ extern "C"
         } nav;
     } modes_message_t;
 
+    // Tracked aircraft: an open-addressed (linear probing) table with the
+    // addresses stored inline, plus a list in creation order for iteration.
+    struct aircraft_table
+    {
+        uint32_t *keys;             // address per slot, 0 = empty
+        struct aircraft **aircraft; // aircraft per slot
+        uint32_t mask;              // capacity - 1
+        uint32_t count;             // number of aircraft
+        struct aircraft *first;     // oldest aircraft
+        struct aircraft *last;      // newest aircraft
+    };
+
+    // Tracked aircraft by the second at which something about them may next
+    // expire. Level 0 has a slot per second, each further level a slot per
+    // 2^AIRCRAFTS_WHEEL_BITS slots of the level below.
+    struct aircraft_wheel
+    {
+        struct aircraft *slots[AIRCRAFTS_WHEEL_LEVELS][1 << AIRCRAFTS_WHEEL_BITS];
+        uint64_t tick;            // second being processed
+        struct aircraft *pending; // aircraft taken from a slot of 'level' and not handled yet
+        int level;                // level being cascaded down, 0 when visiting
+    };
+
+    // First frame from an address heard only once. The aircraft is only
+    // created when a second message arrives, and this frame is replayed then.
+    struct probation_entry
+    {
+        uint32_t key;                              // address with the top bit set, 0 = empty
+        uint32_t seen;                             // sysTimestampMsg of the frame, low 32 bits
+        unsigned char frame[MODES_LONG_MSG_BYTES]; // frame as received, before error correction
+        uint16_t signal;                           // signalLevel scaled to 0..65535
+    };
+
     // Library global state
     typedef struct
     {
@@ -405,7 +446,18 @@ extern "C"
         int stats_latest_1min;
         int bUserFlags;     // Flags relating to the user details
         double sample_rate; // actual sample rate in use (in hz)
-        struct aircraft *aircrafts[AIRCRAFTS_BUCKETS];
+        struct
+        {
+            double lat;     // Receiver latitude in radians
+            double lon;     // Receiver longitude in radians
+            double sin_lat; // sin(lat), cos(lat) for range and bearing from the receiver
+            double cos_lat;
+        } receiver; // set up by readsb_init() from config.latitude and config.longitude
+        struct aircraft_table aircrafts;
+        struct aircraft_wheel aircraft_wheel;
+        struct probation_entry aircraft_probation[AIRCRAFTS_PROBATION_BUCKETS][AIRCRAFTS_PROBATION_WAYS];
+        struct pool aircraft_pool;      // storage for struct aircraft
+        struct pool aircraft_cold_pool; // storage for struct aircraft_cold
         struct stats stats_current;
         struct stats stats_alltime;
         struct stats stats_periodic;
@@ -428,6 +480,13 @@ extern "C"
             uint8_t nfix_crc;   // Number of crc bit error(s) to correct
             uint8_t mode_ac;    // Enable decoding of SSR Modes A & C
             uint8_t dc_filter;  // Should we apply a DC filter?
+            uint32_t sample_rate; // Magnitude sample rate in Hz (0 = 2.4MHz, or a multiple of 2MHz from 6 to 24MHz)
+            uint8_t demod_overlap; // Look for stronger frames overlapping a decoded one (2.4MHz only)
+            uint16_t demod_capture_size; // Rejected candidates kept for diagnostics (0 = capture disabled)
+            uint16_t demod_capture_rate; // Capture one in every N rejected candidates
+            uint32_t aircraft_prealloc; // Aircraft records to allocate up front (0 = as needed)
+            uint32_t maintenance_budget; // Aircraft or Mode A/C codes handled per demodulated block (0 = all at once, from track_periodic_update)
+            uint32_t max_aircraft; // Most aircraft tracked at once, the least recently seen are evicted beyond that (0 = no limit)
         } config;
     } readsb_t;
 
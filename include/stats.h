@@ -10,6 +10,22 @@ extern "C"
 #include <time.h>
 #include "crc.h"
 
+    // Log-bucketed latency histogram, in microseconds.
+    // Values below 2^LATENCY_HIST_SUB_BITS get a bucket each; above that every
+    // power of two is split into 2^LATENCY_HIST_SUB_BITS buckets (~12% wide).
+#define LATENCY_HIST_SUB_BITS 3
+#define LATENCY_HIST_SUB_BUCKETS (1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS 32 // values are clamped to 2^32-1 us (~71 minutes)
+#define LATENCY_HIST_BUCKETS ((LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB_BUCKETS)
+
+    struct latency_hist
+    {
+        uint64_t count;
+        uint64_t sum;
+        uint32_t max;
+        uint32_t buckets[LATENCY_HIST_BUCKETS];
+    };
+
     struct stats
     {
         uint64_t start;
@@ -19,6 +35,7 @@ extern "C"
         uint32_t demod_rejected_bad;
         uint32_t demod_rejected_unknown_icao;
         uint32_t demod_accepted[MODES_MAX_BITERRORS + 1];
+        uint32_t demod_recovered; // overlapping frames that replaced a weaker one
         uint64_t samples_processed;
         uint64_t samples_dropped;
         // Mode A/C demodulator counts:
@@ -72,6 +89,16 @@ extern "C"
         uint32_t with_positions; // Aircrafts with positions
         uint32_t mlat_positions; // Positions from mlat source
         uint32_t tisb_positions; // Positions from tisb source
+        uint32_t aircraft_pool_used;       // Aircraft records in use
+        uint32_t aircraft_pool_allocated;  // Aircraft records allocated
+        uint32_t aircraft_pool_high_water; // Most aircraft records in use at once
+        uint32_t aircraft_evicted;         // Aircraft dropped to stay within the configured maximum
+        // pipeline latency:
+        struct latency_hist latency_block_to_demod;  // reader handing a block over -> demodulator starting on it
+        struct latency_hist latency_demod_to_decode; // demodulator starting on a block -> message decoded
+        struct latency_hist latency_decode_to_track; // message decoded -> aircraft updated
+        struct latency_hist latency_block;           // demodulator starting on a block -> block and its maintenance done
+        struct latency_hist latency_maintenance;     // one run of the periodic tracking maintenance
     };
 
     struct range_stats
@@ -84,6 +111,11 @@ extern "C"
 
     void add_stats(const struct stats *st1, const struct stats *st2, struct stats *target);
     void reset_stats(struct stats *st);
+    void latency_hist_add(struct latency_hist *h, uint64_t us);
+    void latency_hist_merge(const struct latency_hist *h1, const struct latency_hist *h2, struct latency_hist *target);
+    // Smallest value v such that at least 'pct' percent of the samples are <= v
+    // (bucket upper bound, clamped to the maximum seen). 0 if empty.
+    uint32_t latency_hist_percentile(const struct latency_hist *h, double pct);
     void add_timespecs(const struct timespec *x, const struct timespec *y, struct timespec *z);
 
 #ifdef __cplusplus
@@ -0,0 +1,44 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Static tracepoints (USDT) for perf / bpftrace / systemtap.
+    //
+    // Built with -DWITH_USDT=ON these expand to DTRACE_PROBEn() from <sys/sdt.h>,
+    // which leaves a single nop in the code and a note describing the probe
+    // (provider "libreadsb"); list them with e.g. `bpftrace -l 'usdt:liblibreadsb.so:*'`.
+    // Otherwise they expand to nothing and their arguments are not evaluated.
+    //
+    // Probes:
+    //   fifo_enqueue(sampleTimestamp, validLength)
+    //   fifo_dequeue(sampleTimestamp, validLength)
+    //   demod_preamble(timestamp, high)      preamble passed the demodulator checks
+    //   demod_accept(timestamp, score, addr) frame decoded, about to be used
+    //   decode(msgtype, addr, result)        decode_modes_message() return value
+    //   track_entry(addr, msgtype)
+    //   track_exit(addr, messages)           messages = 0 if the message was not tracked
+    //   cpr_global(addr, surface, result)    do_global_cpr() outcome
+    //   cpr_local(addr, surface, result)     do_local_cpr() outcome
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define READSB_TRACE0(name) DTRACE_PROBE(libreadsb, name)
+#define READSB_TRACE1(name, a1) DTRACE_PROBE1(libreadsb, name, a1)
+#define READSB_TRACE2(name, a1, a2) DTRACE_PROBE2(libreadsb, name, a1, a2)
+#define READSB_TRACE3(name, a1, a2, a3) DTRACE_PROBE3(libreadsb, name, a1, a2, a3)
+#else
+#define READSB_TRACE0(name) do { } while (0)
+#define READSB_TRACE1(name, a1) READSB_TRACE0(name)
+#define READSB_TRACE2(name, a1, a2) READSB_TRACE0(name)
+#define READSB_TRACE3(name, a1, a2, a3) READSB_TRACE0(name)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TRACE_H */
@@ -17,6 +17,12 @@ extern "C"
 /* Maximum age of a tracked aircraft with only 1 message received, in milliseconds */
 #define TRACK_AIRCRAFT_ONEHIT_TTL 60000
 
+/* Tracked aircraft sampled when one has to be evicted to stay within config.max_aircraft */
+#define TRACK_EVICT_SAMPLES 16
+
+/* Sampled aircraft with fewer messages than this are evicted before the others */
+#define TRACK_EVICT_FEW_MESSAGES 10
+
 /* Minimum number of repeated Mode A/C replies with a particular Mode A code needed in a
  * 1 second period before accepting that code.
  */
@@ -27,51 +33,97 @@ extern "C"
 
 #define ALTITUDE_BARO_RELIABLE_MAX 20
 
+    /* Fields with validity tracking, indexing track_validity_intervals */
+    typedef enum
+    {
+        VALIDITY_DEFAULT = 0, // data without its own entry (60s stale, 70s expiry)
+        VALIDITY_CALLSIGN,
+        VALIDITY_ALTITUDE_BARO,
+        VALIDITY_ALTITUDE_GEOM,
+        VALIDITY_GEOM_DELTA,
+        VALIDITY_GS,
+        VALIDITY_IAS,
+        VALIDITY_TAS,
+        VALIDITY_MACH,
+        VALIDITY_TRACK,
+        VALIDITY_TRACK_RATE,
+        VALIDITY_ROLL,
+        VALIDITY_MAG_HEADING,
+        VALIDITY_TRUE_HEADING,
+        VALIDITY_BARO_RATE,
+        VALIDITY_GEOM_RATE,
+        VALIDITY_SQUAWK,
+        VALIDITY_AIRGROUND,
+        VALIDITY_NAV_QNH,
+        VALIDITY_NAV_ALTITUDE_MCP,
+        VALIDITY_NAV_ALTITUDE_FMS,
+        VALIDITY_NAV_ALTITUDE_SRC,
+        VALIDITY_NAV_HEADING,
+        VALIDITY_NAV_MODES,
+        VALIDITY_CPR_ODD,
+        VALIDITY_CPR_EVEN,
+        VALIDITY_POSITION,
+        VALIDITY_NIC_A,
+        VALIDITY_NIC_C,
+        VALIDITY_NIC_BARO,
+        VALIDITY_NAC_P,
+        VALIDITY_NAC_V,
+        VALIDITY_SIL,
+        VALIDITY_GVA,
+        VALIDITY_SDA,
+        VALIDITY_FIELDS
+    } validity_field_t;
+
+    struct validity_interval
+    {
+        uint32_t stale;  /* how long after an update until the data is stale, ms */
+        uint32_t expire; /* how long after an update until the data expires, ms */
+    };
+
+    extern const struct validity_interval track_validity_intervals[VALIDITY_FIELDS];
+
+    /* Times are the low 32 bits of the millisecond clock, compared with
+     * wrapping arithmetic; the periodic expiry invalidates data long before
+     * that matters. Stale and expiry times are the update time plus the
+     * field's intervals, less the cuts that combined data may carry.
+     * An update time of 0 means the data was never set.
+     */
     typedef struct
     {
-        uint64_t stale_interval;      /* how long after an update until the data is stale */
-        uint64_t expire_interval;     /* how long after an update until the data expires */
-        uint64_t updated;             /* when it arrived */
-        uint64_t stale;               /* when it goes stale */
-        uint64_t expires;             /* when it expires */
-        uint64_t next_reduce_forward; /* when to next forward the data for reduced beast output */
-        datasource_t source;          /* where the data came from */
-        uint32_t padding;
+        uint32_t updated;             /* when it arrived */
+        uint32_t next_reduce_forward; /* when to next forward the data for reduced beast output */
+        uint32_t stale_cut : 24;      /* how much earlier than usual it goes stale, ms */
+        uint32_t field : 8;           /* validity_field_t */
+        uint32_t expire_cut : 24;     /* how much earlier than usual it expires, ms */
+        uint32_t source : 8;          /* datasource_t, where the data came from */
     } data_validity;
 
-    /* Structure used to describe the state of one tracked aircraft */
-    struct aircraft
+    /* Membership of an aircraft in the list of aircraft that could be
+     * answering one Mode A/C code, see track_match_ac()
+     */
+    struct modeac_link
     {
-        uint32_t addr;       // The 24-bit ICAO identifier of the aircraft, as 6 hex digits. The identifier may start with '~', this means that the address is a non-ICAO address (e.g. from TIS-B).
-        char flight_id[12];  // Flight ID, the flight name or aircraft registration as 8 chars.
-        uint32_t squawk;     // Mode A code (Squawk), encoded as 4 octal digits.
-        uint32_t category;   // Emitter category to identify particular aircraft or vehicle classes (values A0 - D7).
-        int32_t alt_baro;    // The aircraft barometric altitude in feet.
-        int32_t mag_heading; // Heading, degrees clockwise from magnetic north.
-        uint32_t ias;        // Indicated air speed in knots.
-        double lat;          // Aircraft position latitude in decimal degrees.
-        double lon;          // Aircraft position longitude in decimal degrees.
-        uint64_t messages;   // Total number of Mode S messages received from this aircraft.
-        uint64_t seen_ms;    // When a message was last received from this aircraft. (in milliseconds!!!)
-        float rssi;          // Recent average RSSI (signal power), in dbFS; this will always be negative.
-        uint32_t distance;   // Distance to site in meter.
-        air_ground_t air_ground;
-        int32_t alt_geom;         // Geometric (GNSS / INS) altitude in feet referenced to the WGS84 ellipsoid.
-        int32_t baro_rate;        // Rate of change of barometric altitude, feet/minute.
-        int32_t geom_rate;        // Rate of change of geometric (GNSS / INS) altitude. feet/minute
-        uint32_t gs;              // Ground speed in knots.
+        struct modeac_link *next;
+        struct modeac_link **pprev; // NULL when not filed under any code
+        struct aircraft *aircraft;
+    };
+
+    /* Rarely updated state of a tracked aircraft: Comm-B only or slow
+     * ADS-B data, navigation settings, accuracy and integrity figures.
+     * Kept out of struct aircraft so a typical position or velocity update
+     * touches fewer cache lines.
+     */
+    struct aircraft_cold
+    {
+        uint32_t ias;             // Indicated air speed in knots.
         uint32_t tas;             // True air speed in knots.
         float mach;               // Mach number.
-        int32_t true_heading;     // Heading, degrees clockwise from true north.
-        int32_t track;            // True track over ground in degrees (0-359).
         float track_rate;         // Rate of change of track, degrees/second.
         float roll;               // Roll, degrees, negative is left roll.
         float nav_qnh;            // Navigation Accuracy for Velocity.
         int32_t nav_altitude_mcp; // Selected altitude from the Mode Control Panel / Flight Control Unit (MCP/FCU) or equivalent equipment.
         int32_t nav_altitude_fms; // Selected altitude from the Flight Management System (FMS).
         int32_t nav_heading;      // Selected heading (True or Magnetic is not defined in DO-260B, mostly Magnetic as that is the de facto standard).
-        uint32_t nic;             // Navigation Integrity Category.
-        uint32_t rc;              // Radius of Containment, meters; a measure of position integrity derived from NIC & supplementary bits.
         int32_t version;          // ADS-B Version Number 0, 1, 2 (3-7 are reserved)
         uint32_t nic_baro;        // Navigation Integrity Category for Barometric Altitude
         uint32_t nac_p;           // Navigation Accuracy for Position
@@ -82,12 +134,11 @@ extern "C"
         bool spi;                 // Flight status special position identification bit.
         uint32_t gva;             // Geometric Vertical Accuracy
         uint32_t sda;             // System Design Assurance
-        double declination;       // Geomagnetic declination depending on position
         uint32_t wind_speed;      // Calculated wind speed
         uint32_t wind_direction;  // Calculated wind direction
-        addr_type_t addr_type;
         emergency_t emergency;
         sil_type_t sil_type;
+        nav_altitude_source_t nav_altitude_src; // source of altitude used by automation
 
         struct
         {
@@ -135,64 +186,46 @@ extern "C"
             uint32_t sda;
             uint32_t wind;
         } valid_source;
-        // Remaining variables are all readsb internal use.
-        double signalLevel[8]; // Last 8 Signal Amplitudes
-        int signalNext;        // next index of signalLevel to use
-        int altitude_baro_reliable;
-        int geom_delta; // Difference between Geometric and Baro altitudes
-        unsigned cpr_odd_lat;
-        unsigned cpr_odd_lon;
-        unsigned cpr_odd_nic;
-        unsigned cpr_odd_rc;
-        unsigned cpr_even_lat;
-        unsigned cpr_even_lon;
-        unsigned cpr_even_nic;
-        unsigned cpr_even_rc;
-        uint64_t next_reduce_forward_DF11;
-        data_validity callsign_valid;
-        data_validity altitude_baro_valid;
-        data_validity altitude_geom_valid;
-        data_validity geom_delta_valid;
-        data_validity gs_valid;
+
         data_validity ias_valid;
         data_validity tas_valid;
         data_validity mach_valid;
-        data_validity track_valid;
         data_validity track_rate_valid;
         data_validity roll_valid;
-        data_validity mag_heading_valid;
-        data_validity true_heading_valid;
-        data_validity baro_rate_valid;
-        data_validity geom_rate_valid;
-        data_validity nic_a_valid;
-        data_validity nic_c_valid;
         data_validity nic_baro_valid;
         data_validity nac_p_valid;
         data_validity nac_v_valid;
         data_validity sil_valid;
         data_validity gva_valid;
         data_validity sda_valid;
-        data_validity squawk_valid;
         data_validity emergency_valid;
-        data_validity airground_valid;
         data_validity nav_qnh_valid;
         data_validity nav_altitude_mcp_valid;
         data_validity nav_altitude_fms_valid;
         data_validity nav_altitude_src_valid;
         data_validity nav_heading_valid;
         data_validity nav_modes_valid;
-        data_validity cpr_odd_valid;  // Last seen even CPR message
-        data_validity cpr_even_valid; // Last seen odd CPR message
-        data_validity position_valid;
         data_validity alert_valid;
         data_validity spi_valid;
 
-        cpr_type_t cpr_odd_type;
-        cpr_type_t cpr_even_type;
-        nav_altitude_source_t nav_altitude_src; // source of altitude used by automation
-        int pos_reliable_odd;                   // Number of good global CPRs, indicates position reliability
-        int pos_reliable_even;
-        float gs_last_pos; // Save a groundspeed associated with the last position
+        // Mode A/C codes this aircraft could be answering, kept up to date
+        // only when Mode A/C decoding is enabled: the squawk, then the
+        // Mode C level of the barometric altitude and the ones either side,
+        // each in the link given by the level modulo 3
+        struct modeac_link modeac_links[4];
+    };
+
+    /* Structure used to describe the state of one tracked aircraft.
+     * Fields are ordered so those every message touches come first.
+     */
+    struct aircraft
+    {
+        uint32_t addr;         // The 24-bit ICAO identifier of the aircraft, as 6 hex digits. The identifier may start with '~', this means that the address is a non-ICAO address (e.g. from TIS-B).
+        addr_type_t addr_type;
+        uint64_t messages;     // Total number of Mode S messages received from this aircraft.
+        uint64_t seen_ms;      // When a message was last received from this aircraft. (in milliseconds!!!)
+        double signalLevel[8]; // Last 8 Signal Amplitudes
+        int signalNext;        // next index of signalLevel to use
         // data extracted from opstatus etc
         int adsb_version;              // ADS-B version (from ADS-B operational status); -1 means no ADS-B messages seen
         int adsr_version;              // As above, for ADS-R messages
@@ -204,8 +237,69 @@ extern "C"
         unsigned nic_c : 1;            // NIC supplement C from opstatus
         int modeA_hit;                 // did our squawk match a possible mode A reply in the last check period?
         int modeC_hit;                 // did our altitude match a possible mode C reply in the last check period?
-        modes_message_t first_message; // A copy of the first message we received for this aircraft.
-        struct aircraft *next;         // Next aircraft in our linked list
+        int modeac_level;              // Mode C level the altitude is filed around in the Mode A/C code lists
+        bool modeac_squawk_filed;      // the squawk is filed in the Mode A/C code lists
+        bool modeac_level_filed;       // modeac_level is set
+        struct aircraft_cold *cold;    // Rarely updated state
+        struct aircraft *next;         // Next aircraft in creation order
+        struct aircraft *prev;         // Previous aircraft in creation order
+        struct aircraft *wheel_next;   // Next aircraft in the same timer wheel slot
+        struct aircraft **wheel_pprev; // Link pointing at this aircraft in its timer wheel slot
+        uint64_t wheel_due;            // Second at which the timer wheel visits this aircraft
+
+        char flight_id[12];  // Flight ID, the flight name or aircraft registration as 8 chars.
+        uint32_t squawk;     // Mode A code (Squawk), encoded as 4 octal digits.
+        uint32_t category;   // Emitter category to identify particular aircraft or vehicle classes (values A0 - D7).
+        int32_t alt_baro;    // The aircraft barometric altitude in feet.
+        int32_t mag_heading; // Heading, degrees clockwise from magnetic north.
+        double lat;          // Aircraft position latitude in decimal degrees.
+        double lon;          // Aircraft position longitude in decimal degrees.
+        float rssi;          // Recent average RSSI (signal power), in dbFS; this will always be negative.
+        uint32_t distance;   // Distance to site in meter.
+        air_ground_t air_ground;
+        int32_t alt_geom;     // Geometric (GNSS / INS) altitude in feet referenced to the WGS84 ellipsoid.
+        int32_t baro_rate;    // Rate of change of barometric altitude, feet/minute.
+        int32_t geom_rate;    // Rate of change of geometric (GNSS / INS) altitude. feet/minute
+        uint32_t gs;          // Ground speed in knots.
+        int32_t true_heading; // Heading, degrees clockwise from true north.
+        int32_t track;        // True track over ground in degrees (0-359).
+        uint32_t nic;         // Navigation Integrity Category.
+        uint32_t rc;          // Radius of Containment, meters; a measure of position integrity derived from NIC & supplementary bits.
+        double declination;   // Geomagnetic declination depending on position
+        // Remaining variables are all readsb internal use.
+        int altitude_baro_reliable;
+        int geom_delta; // Difference between Geometric and Baro altitudes
+        unsigned cpr_odd_lat;
+        unsigned cpr_odd_lon;
+        unsigned cpr_odd_nic;
+        unsigned cpr_odd_rc;
+        unsigned cpr_even_lat;
+        unsigned cpr_even_lon;
+        unsigned cpr_even_nic;
+        unsigned cpr_even_rc;
+        cpr_type_t cpr_odd_type;
+        cpr_type_t cpr_even_type;
+        int pos_reliable_odd; // Number of good global CPRs, indicates position reliability
+        int pos_reliable_even;
+        float gs_last_pos; // Save a groundspeed associated with the last position
+        uint64_t next_reduce_forward_DF11;
+        data_validity altitude_baro_valid;
+        data_validity airground_valid;
+        data_validity cpr_odd_valid;  // Last seen even CPR message
+        data_validity cpr_even_valid; // Last seen odd CPR message
+        data_validity position_valid;
+        data_validity gs_valid;
+        data_validity track_valid;
+        data_validity baro_rate_valid;
+        data_validity geom_rate_valid;
+        data_validity altitude_geom_valid;
+        data_validity geom_delta_valid;
+        data_validity mag_heading_valid;
+        data_validity true_heading_valid;
+        data_validity squawk_valid;
+        data_validity callsign_valid;
+        data_validity nic_a_valid;
+        data_validity nic_c_valid;
     };
 
     /* Mode A/C tracking is done separately, not via the aircraft list,
@@ -216,17 +310,35 @@ extern "C"
     extern uint32_t modeAC_match[4096];
     extern uint32_t modeAC_age[4096];
 
+    /* is 32-bit time t1 before t2? */
+    static inline int track_time_before(uint32_t t1, uint32_t t2)
+    {
+        return (int32_t)(t1 - t2) < 0;
+    }
+
+    /* when does this bit of data go stale? */
+    static inline uint32_t track_data_stale_time(const data_validity *v)
+    {
+        return v->updated + track_validity_intervals[v->field].stale - v->stale_cut;
+    }
+
+    /* when does this bit of data expire? */
+    static inline uint32_t track_data_expire_time(const data_validity *v)
+    {
+        return v->updated + track_validity_intervals[v->field].expire - v->expire_cut;
+    }
+
     /* is this bit of data valid? */
     static inline int
     track_data_valid(const data_validity *v)
     {
-        return (v->source != SOURCE_INVALID && messageNow() < v->expires);
+        return (v->source != SOURCE_INVALID && track_time_before((uint32_t)messageNow(), track_data_expire_time(v)));
     }
 
     /* is this bit of data fresh? */
     static inline int track_data_stale(const data_validity *v)
     {
-        return (v->source != SOURCE_INVALID && messageNow() < v->stale);
+        return (v->source != SOURCE_INVALID && track_time_before((uint32_t)messageNow(), track_data_stale_time(v)));
     }
 
     /* what's the age of this data, in milliseconds? */
@@ -234,9 +346,9 @@ extern "C"
     {
         if (v->source == SOURCE_INVALID)
             return ~(uint64_t)0;
-        if (v->updated >= messageNow())
+        if (!track_time_before(v->updated, (uint32_t)messageNow()))
             return 0;
-        return (messageNow() - v->updated);
+        return ((uint32_t)messageNow() - v->updated);
     }
 
     /* Update aircraft state from data in the provided mesage.
@@ -248,6 +360,20 @@ extern "C"
     /* Call periodically */
     void track_periodic_update();
 
+    /* Do at most config.maintenance_budget items of the periodic work;
+     * called by the demodulators after each block when a budget is set.
+     */
+    void track_maintenance_step();
+
+    /* Allocate the aircraft table. Returns false if out of memory. */
+    bool track_init();
+
+    /* Return the aircraft with the given address, or NULL */
+    struct aircraft *track_find_aircraft(uint32_t addr);
+
+    /* Free all tracked aircraft and the table */
+    void track_cleanup();
+
     static inline int
     min(int a, int b)
     {
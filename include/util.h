@@ -11,6 +11,9 @@ extern "C"
     /* Returns system time in milliseconds */
     uint64_t mstime(void);
 
+    /* Returns a monotonic clock in microseconds, for measuring intervals */
+    uint64_t ustime(void);
+
     /* Returns the time for the current message we're dealing with */
     extern uint64_t _messageNow;
 
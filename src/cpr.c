@@ -19,134 +19,47 @@ static double cpr_mod_double(double a, double b)
     return res;
 }
 
-// The NL function uses the precomputed table from 1090-WP-9-14
+// The NL function uses the precomputed table from 1090-WP-9-14:
+// latitude at which NL drops below n, indexed by n (0 and 1 unused)
+static const double cpr_nl_bounds[60] = {
+    0.0, 90.0, 87.00000000, 86.53536998, 85.75541621, 84.89166191,
+    83.99173563, 83.07199445, 82.13956981, 81.19801349, 80.24923213, 79.29428225,
+    78.33374083, 77.36789461, 76.39684391, 75.42056257, 74.43893416, 73.45177442,
+    72.45884545, 71.45986473, 70.45451075, 69.44242631, 68.42322022, 67.39646774,
+    66.36171008, 65.31845310, 64.26616523, 63.20427479, 62.13216659, 61.04917774,
+    59.95459277, 58.84763776, 57.72747354, 56.59318756, 55.44378444, 54.27817472,
+    53.09516153, 51.89342469, 50.67150166, 49.42776439, 48.16039128, 46.86733252,
+    45.54626723, 44.19454951, 42.80914012, 41.38651832, 39.92256684, 38.41241892,
+    36.85025108, 35.22899598, 33.53993436, 31.77209708, 29.91135686, 27.93898710,
+    25.82924707, 23.54504487, 21.02939493, 18.18626357, 14.82817437, 10.47047130};
+
+// NL at each whole degree of latitude, 0 .. 86
+static const unsigned char cpr_nl_degree[87] = {
+    59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 58, 58, 58, 58,
+    57, 57, 57, 57, 56, 56, 56, 55, 55, 54, 54, 53, 53, 52, 52,
+    51, 51, 50, 50, 49, 49, 48, 47, 47, 46, 45, 45, 44, 43, 43,
+    42, 41, 40, 40, 39, 38, 37, 36, 36, 35, 34, 33, 32, 31, 30,
+    29, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16,
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 5, 4, 3};
+
 static int cpr_nl(double lat)
 {
     if (lat < 0)
         lat = -lat; // Table is simmetric about the equator
-    if (lat < 10.47047130)
-        return 59;
-    if (lat < 14.82817437)
-        return 58;
-    if (lat < 18.18626357)
-        return 57;
-    if (lat < 21.02939493)
-        return 56;
-    if (lat < 23.54504487)
-        return 55;
-    if (lat < 25.82924707)
-        return 54;
-    if (lat < 27.93898710)
-        return 53;
-    if (lat < 29.91135686)
-        return 52;
-    if (lat < 31.77209708)
-        return 51;
-    if (lat < 33.53993436)
-        return 50;
-    if (lat < 35.22899598)
-        return 49;
-    if (lat < 36.85025108)
-        return 48;
-    if (lat < 38.41241892)
-        return 47;
-    if (lat < 39.92256684)
-        return 46;
-    if (lat < 41.38651832)
-        return 45;
-    if (lat < 42.80914012)
-        return 44;
-    if (lat < 44.19454951)
-        return 43;
-    if (lat < 45.54626723)
-        return 42;
-    if (lat < 46.86733252)
-        return 41;
-    if (lat < 48.16039128)
-        return 40;
-    if (lat < 49.42776439)
-        return 39;
-    if (lat < 50.67150166)
-        return 38;
-    if (lat < 51.89342469)
-        return 37;
-    if (lat < 53.09516153)
-        return 36;
-    if (lat < 54.27817472)
-        return 35;
-    if (lat < 55.44378444)
-        return 34;
-    if (lat < 56.59318756)
-        return 33;
-    if (lat < 57.72747354)
-        return 32;
-    if (lat < 58.84763776)
-        return 31;
-    if (lat < 59.95459277)
-        return 30;
-    if (lat < 61.04917774)
-        return 29;
-    if (lat < 62.13216659)
-        return 28;
-    if (lat < 63.20427479)
-        return 27;
-    if (lat < 64.26616523)
-        return 26;
-    if (lat < 65.31845310)
-        return 25;
-    if (lat < 66.36171008)
-        return 24;
-    if (lat < 67.39646774)
-        return 23;
-    if (lat < 68.42322022)
-        return 22;
-    if (lat < 69.44242631)
-        return 21;
-    if (lat < 70.45451075)
-        return 20;
-    if (lat < 71.45986473)
-        return 19;
-    if (lat < 72.45884545)
-        return 18;
-    if (lat < 73.45177442)
-        return 17;
-    if (lat < 74.43893416)
-        return 16;
-    if (lat < 75.42056257)
-        return 15;
-    if (lat < 76.39684391)
-        return 14;
-    if (lat < 77.36789461)
-        return 13;
-    if (lat < 78.33374083)
-        return 12;
-    if (lat < 79.29428225)
-        return 11;
-    if (lat < 80.24923213)
-        return 10;
-    if (lat < 81.19801349)
-        return 9;
-    if (lat < 82.13956981)
-        return 8;
-    if (lat < 83.07199445)
-        return 7;
-    if (lat < 83.99173563)
-        return 6;
-    if (lat < 84.89166191)
-        return 5;
-    if (lat < 85.75541621)
-        return 4;
-    if (lat < 86.53536998)
-        return 3;
-    if (lat < 87.00000000)
-        return 2;
-    else
+    if (!(lat < 87.0))
         return 1;
+
+    // A degree of latitude holds at most two zone boundaries
+    int nl = cpr_nl_degree[(int)lat];
+    nl -= (lat >= cpr_nl_bounds[nl]);
+    nl -= (lat >= cpr_nl_bounds[nl]);
+    return nl;
 }
 
-static int cpr_n(double lat, int fflag)
+// Number of longitude zones for a latitude zone number
+static int cpr_ni(int nl, int fflag)
 {
-    int nl = cpr_nl(lat) - (fflag ? 1 : 0);
+    nl -= (fflag ? 1 : 0);
     if (nl < 1)
         nl = 1;
     return nl;
@@ -154,7 +67,7 @@ static int cpr_n(double lat, int fflag)
 
 static double cpr_dlon(double lat, int fflag, int surface)
 {
-    return (surface ? 90.0 : 360.0) / cpr_n(lat, fflag);
+    return (surface ? 90.0 : 360.0) / cpr_ni(cpr_nl(lat), fflag);
 }
 
 /* This algorithm comes from:
@@ -191,28 +104,25 @@ int decode_cpr_airborne(int even_cprlat, int even_cprlon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cpr_nl(rlat0) != cpr_nl(rlat1))
+    int nl = cpr_nl(rlat0);
+    if (nl != cpr_nl(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
+    int m = (int)floor((((lon0 * (nl - 1)) -
+                         (lon1 * nl)) /
+                        131072.0) +
+                       0.5);
     if (fflag)
     { // Use odd packet.
-        int ni = cpr_n(rlat1, 1);
-        int m = (int)floor((((lon0 * (cpr_nl(rlat1) - 1)) -
-                             (lon1 * cpr_nl(rlat1))) /
-                            131072.0) +
-                           0.5);
-        rlon = cpr_dlon(rlat1, 1, 0) * (cpr_mod_int(m, ni) + lon1 / 131072);
+        int ni = cpr_ni(nl, 1);
+        rlon = (360.0 / ni) * (cpr_mod_int(m, ni) + lon1 / 131072);
         rlat = rlat1;
     }
     else
     { // Use even packet.
-        int ni = cpr_n(rlat0, 0);
-        int m = (int)floor((((lon0 * (cpr_nl(rlat0) - 1)) -
-                             (lon1 * cpr_nl(rlat0))) /
-                            131072) +
-                           0.5);
-        rlon = cpr_dlon(rlat0, 0, 0) * (cpr_mod_int(m, ni) + lon0 / 131072);
+        int ni = cpr_ni(nl, 0);
+        rlon = (360.0 / ni) * (cpr_mod_int(m, ni) + lon0 / 131072);
         rlat = rlat0;
     }
 
@@ -225,6 +135,58 @@ int decode_cpr_airborne(int even_cprlat, int even_cprlon,
     return 0;
 }
 
+/* Decode many airborne even/odd pairs at once, e.g. when reprocessing
+ * recorded traffic. Same arithmetic as decode_cpr_airborne, on separate
+ * arrays and without early exits so the loop body is straight-line code.
+ * status[i] receives what decode_cpr_airborne would have returned;
+ * out_lat[i] and out_lon[i] are only meaningful where it is 0.
+ * Returns the number of pairs decoded.
+ */
+unsigned decode_cpr_airborne_batch(unsigned count,
+                                   const int *even_cprlat, const int *even_cprlon,
+                                   const int *odd_cprlat, const int *odd_cprlon,
+                                   const int *fflag,
+                                   double *out_lat, double *out_lon, int *status)
+{
+    double AirDlat0 = 360.0 / 60.0;
+    double AirDlat1 = 360.0 / 59.0;
+    unsigned decoded = 0;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        double lat0 = even_cprlat[i];
+        double lat1 = odd_cprlat[i];
+        double lon0 = even_cprlon[i];
+        double lon1 = odd_cprlon[i];
+        int odd = fflag[i] ? 1 : 0;
+
+        int j = (int)floor(((59 * lat0 - 60 * lat1) / 131072) + 0.5);
+        double rlat0 = AirDlat0 * (cpr_mod_int(j, 60) + lat0 / 131072);
+        double rlat1 = AirDlat1 * (cpr_mod_int(j, 59) + lat1 / 131072);
+        rlat0 -= (rlat0 >= 270) ? 360 : 0;
+        rlat1 -= (rlat1 >= 270) ? 360 : 0;
+
+        int bad = (rlat0 < -90) | (rlat0 > 90) | (rlat1 < -90) | (rlat1 > 90);
+        int nl = cpr_nl(rlat0);
+        int crossed = nl != cpr_nl(rlat1);
+
+        int m = (int)floor((((lon0 * (nl - 1)) -
+                             (lon1 * nl)) /
+                            131072.0) +
+                           0.5);
+        int ni = cpr_ni(nl, odd);
+        double rlon = (360.0 / ni) * (cpr_mod_int(m, ni) + (odd ? lon1 : lon0) / 131072);
+        rlon -= floor((rlon + 180) / 360) * 360;
+
+        out_lat[i] = odd ? rlat1 : rlat0;
+        out_lon[i] = rlon;
+        status[i] = bad ? -2 : crossed ? -1 : 0;
+        decoded += !(bad | crossed);
+    }
+
+    return decoded;
+}
+
 int decode_cpr_surface(double reflat, double reflon,
                        int even_cprlat, int even_cprlon,
                        int odd_cprlat, int odd_cprlon,
@@ -296,28 +258,25 @@ int decode_cpr_surface(double reflat, double reflon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cpr_nl(rlat0) != cpr_nl(rlat1))
+    int nl = cpr_nl(rlat0);
+    if (nl != cpr_nl(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
+    int m = (int)floor((((lon0 * (nl - 1)) -
+                         (lon1 * nl)) /
+                        131072.0) +
+                       0.5);
     if (fflag)
     { // Use odd packet.
-        int ni = cpr_n(rlat1, 1);
-        int m = (int)floor((((lon0 * (cpr_nl(rlat1) - 1)) -
-                             (lon1 * cpr_nl(rlat1))) /
-                            131072.0) +
-                           0.5);
-        rlon = cpr_dlon(rlat1, 1, 1) * (cpr_mod_int(m, ni) + lon1 / 131072);
+        int ni = cpr_ni(nl, 1);
+        rlon = (90.0 / ni) * (cpr_mod_int(m, ni) + lon1 / 131072);
         rlat = rlat1;
     }
     else
     { // Use even packet.
-        int ni = cpr_n(rlat0, 0);
-        int m = (int)floor((((lon0 * (cpr_nl(rlat0) - 1)) -
-                             (lon1 * cpr_nl(rlat0))) /
-                            131072) +
-                           0.5);
-        rlon = cpr_dlon(rlat0, 0, 1) * (cpr_mod_int(m, ni) + lon0 / 131072);
+        int ni = cpr_ni(nl, 0);
+        rlon = (90.0 / ni) * (cpr_mod_int(m, ni) + lon0 / 131072);
         rlat = rlat0;
     }
 
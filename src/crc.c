@@ -5,328 +5,260 @@
 #include <assert.h>
 #include "readsb_def.h"
 #include "crc.h"
+#include "crc_tables.h"
 
 // Errorinfo for "no errors"
-static struct errorinfo NO_ERRORS;
+static const struct errorinfo NO_ERRORS;
 
-// Generator polynomial for the Mode S CRC:
-#define MODES_GENERATOR_POLY 0xfff409U
+// The full generator, including the x^24 term
+#define MODES_GENERATOR_POLY_FULL (0x1000000U | MODES_GENERATOR_POLY)
 
-// CRC values for all single-byte messages;
-// used to speed up CRC calculation.
-static uint32_t crc_table[256];
+// Slicing-by-4 tables for the portable CRC. The 24-bit remainder is kept
+// in the top of a 32-bit register so that four message bytes can be folded
+// in with one lookup per byte; crc_table[k] advances a byte by k more bytes.
+static uint32_t crc_table[4][256];
 
-// Syndrome values for all single-bit errors;
-// used to speed up construction of error-
-// correction tables.
-static uint32_t single_bit_syndrome[112];
+// Computes the CRC (remainder of data(x) * x^24 mod G) of n bytes
+static uint32_t crc_slice4(const uint8_t *data, int n);
+static uint32_t (*crc_bytes)(const uint8_t *data, int n) = crc_slice4;
 
-static void init_lookup_tables()
+static uint32_t crc_slice4(const uint8_t *data, int n)
 {
-    int i;
-    uint8_t msg[112 / 8];
+    uint32_t s = 0;
+    int i = 0;
 
-    for (i = 0; i < 256; ++i)
+    for (; i + 4 <= n; i += 4)
     {
-        uint32_t c = i << 16;
-        int j;
-        for (j = 0; j < 8; ++j)
-        {
-            if (c & 0x800000)
-                c = (c << 1) ^ MODES_GENERATOR_POLY;
-            else
-                c = (c << 1);
-        }
-
-        crc_table[i] = c & 0x00ffffff;
+        s ^= ((uint32_t)data[i] << 24) | ((uint32_t)data[i + 1] << 16) | ((uint32_t)data[i + 2] << 8) | data[i + 3];
+        s = crc_table[3][s >> 24] ^ crc_table[2][(s >> 16) & 0xff] ^ crc_table[1][(s >> 8) & 0xff] ^ crc_table[0][s & 0xff];
     }
 
-    memset(msg, 0, sizeof(msg));
-    for (i = 0; i < 112; ++i)
-    {
-        msg[i / 8] ^= 1 << (7 - (i & 7));
-        single_bit_syndrome[i] = modes_checksum(msg, 112);
-        msg[i / 8] ^= 1 << (7 - (i & 7));
-    }
+    for (; i < n; ++i)
+        s = (s << 8) ^ crc_table[0][(s >> 24) ^ data[i]];
+
+    return s >> 8;
 }
 
-uint32_t modes_checksum(uint8_t *message, int bits)
-{
-    uint32_t rem = 0;
-    int i;
-    int n = bits / 8;
+/* Carry-less multiply version.
+ *
+ * Messages are consumed in 64-bit chunks d. With r the remainder so far,
+ * the next remainder is ((r * x^40) + d) * x^24 mod G; A = (r << 40) ^ d
+ * fits in 64 bits and the reduction of A * x^24 is done with Barrett:
+ *
+ *   mu = floor(x^88 / G) = x^64 + CRC_BARRETT_MU
+ *   q  = floor(A * mu / x^64) = A ^ hi64(A * CRC_BARRETT_MU)
+ *   r  = low24(q * G)
+ *
+ * A short leading chunk c (the 3 bytes ahead of the last 8 in a 112-bit
+ * frame) is folded in as c * (x^64 mod G) instead of being reduced on its
+ * own, so both frame lengths cost a single Barrett step.
+ */
+#define CRC_BARRETT_MU 0x80090b3e028fb241ULL
+#define CRC_X64_MOD_G 0xf52612ULL
 
-    assert(bits % 8 == 0);
-    assert(n >= 3);
+#if defined(__x86_64__) || defined(__aarch64__)
+static inline uint64_t load_be(const uint8_t *data, int n)
+{
+    uint64_t v = 0;
 
-    for (i = 0; i < n - 3; ++i)
+    if (n == 8)
     {
-        rem = (rem << 8) ^ crc_table[message[i] ^ ((rem & 0xff0000) >> 16)];
-        rem = rem & 0xffffff;
+        memcpy(&v, data, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        return v;
     }
 
-    rem = rem ^ (message[n - 3] << 16) ^ (message[n - 2] << 8) ^ (message[n - 1]);
-    return rem;
+    for (int i = 0; i < n; ++i)
+        v = (v << 8) | data[i];
+    return v;
 }
+#endif
 
-static struct errorinfo *bitErrorTable_short;
-static int bitErrorTableSize_short;
-
-static struct errorinfo *bitErrorTable_long;
-static int bitErrorTableSize_long;
-
-// compare two errorinfo structures
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_HAVE_CLMUL
 
-static int syndrome_compare(const void *x, const void *y)
+__attribute__((target("pclmul"))) static inline uint64_t clmul_lo(uint64_t a, uint64_t b)
 {
-    struct errorinfo *ex = (struct errorinfo *)x;
-    struct errorinfo *ey = (struct errorinfo *)y;
-    return (int)ex->syndrome - (int)ey->syndrome;
+    return (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0x00));
 }
 
-// (n k), the number of ways of selecting k distinct items from a set of n items
-
-static int combinations(int n, int k)
+__attribute__((target("pclmul"))) static inline uint64_t barrett_reduce(uint64_t a)
 {
-    int result = 1, i;
-
-    if (k == 0 || k == n)
-        return 1;
-
-    if (k > n)
-        return 0;
-
-    for (i = 1; i <= k; ++i)
-    {
-        result = result * n / i;
-        n = n - 1;
-    }
-
-    return result;
+    __m128i t = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(CRC_BARRETT_MU), 0x00);
+    uint64_t q = (uint64_t)_mm_cvtsi128_si64(_mm_srli_si128(t, 8)) ^ a;
+    __m128i r = _mm_clmulepi64_si128(_mm_cvtsi64_si128(q), _mm_cvtsi64_si128(MODES_GENERATOR_POLY_FULL), 0x00);
+    return (uint64_t)_mm_cvtsi128_si64(r) & 0xffffff;
 }
 
-// Recursively populates an errorinfo table with error syndromes
-//
-// in:
-//   table:      the table to fill
-//   n:          first entry to fill
-//   maxSize:    max size of table
-//   offset:     start bit offset for checksum calculation
-//   startbit:   first bit to introduce errors into
-//   endbit:     (one past) last bit to introduce errors info
-//   base_entry: template entry to start from
-//   error_bit:  how many error bits have already been set
-//   max_errors: maximum total error bits to set
-// out:
-//   returns:    the next free entry in the table
-//   table:      has been populated between [n, return value)
-
-static int prepare_subtable(struct errorinfo *table, int n, int maxsize, int offset, int startbit, int endbit, struct errorinfo *base_entry, int error_bit, int max_errors)
+static int crc_clmul_supported()
 {
-    int i = 0;
-
-    if (error_bit >= max_errors)
-        return n;
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul");
+}
 
-    for (i = startbit; i < endbit; ++i)
-    {
-        assert(n < maxsize);
+#define CRC_CLMUL_TARGET __attribute__((target("pclmul")))
 
-        table[n] = *base_entry;
-        table[n].syndrome ^= single_bit_syndrome[i + offset];
-        table[n].errors = error_bit + 1;
-        table[n].bit[error_bit] = i;
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#define CRC_HAVE_CLMUL
 
-        ++n;
-        n = prepare_subtable(table, n, maxsize, offset, i + 1, endbit, &table[n - 1], error_bit + 1, max_errors);
-    }
+__attribute__((target("+crypto"))) static inline uint64_t clmul_lo(uint64_t a, uint64_t b)
+{
+    return vgetq_lane_u64(vreinterpretq_u64_p128(vmull_p64((poly64_t)a, (poly64_t)b)), 0);
+}
 
-    return n;
+__attribute__((target("+crypto"))) static inline uint64_t barrett_reduce(uint64_t a)
+{
+    poly128_t t = vmull_p64((poly64_t)a, (poly64_t)CRC_BARRETT_MU);
+    uint64_t q = vgetq_lane_u64(vreinterpretq_u64_p128(t), 1) ^ a;
+    return clmul_lo(q, MODES_GENERATOR_POLY_FULL) & 0xffffff;
 }
 
-static int flag_collisions(struct errorinfo *table, int tablesize, int offset, int startbit, int endbit, uint32_t base_syndrome, int error_bit, int first_error, int last_error)
+static int crc_clmul_supported()
 {
-    int i = 0;
-    int count = 0;
+    return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+}
 
-    if (error_bit > last_error)
-        return 0;
+#define CRC_CLMUL_TARGET __attribute__((target("+crypto")))
+#endif
 
-    for (i = startbit; i < endbit; ++i)
-    {
-        struct errorinfo ei;
+#ifdef CRC_HAVE_CLMUL
+CRC_CLMUL_TARGET static uint32_t crc_clmul(const uint8_t *data, int n)
+{
+    int p = n & 7;
+    int i = p;
+    uint64_t a = 0;
 
-        ei.syndrome = base_syndrome ^ single_bit_syndrome[i + offset];
+    if (n < 8)
+        return (uint32_t)barrett_reduce(load_be(data, n));
 
-        if (error_bit >= first_error)
-        {
-            struct errorinfo *collision = bsearch(&ei, table, tablesize, sizeof(struct errorinfo), syndrome_compare);
-            if (collision != NULL && collision->errors != -1)
-            {
-                ++count;
-                collision->errors = -1;
-            }
-        }
+    if (p > 5)
+        a = barrett_reduce(load_be(data, p)) << 40;
+    else if (p)
+        a = clmul_lo(load_be(data, p), CRC_X64_MOD_G);
 
-        count += flag_collisions(table, tablesize, offset, i + 1, endbit, ei.syndrome, error_bit + 1, first_error, last_error);
-    }
+    for (; i < n; i += 8)
+        a = barrett_reduce(a ^ load_be(data + i, 8)) << 40;
 
-    return count;
+    return (uint32_t)(a >> 40);
 }
+#endif
 
-// Allocate and build an error table for messages of length "bits" (max 112)
-// returns a pointer to the new table and sets *size_out to the table length
-
-static struct errorinfo *prepare_error_table(int bits, int max_correct, int max_detect, int *size_out)
+static void init_lookup_tables()
 {
-    int maxsize, usedsize;
-    struct errorinfo *table;
-    struct errorinfo base_entry;
-    int i, j;
-
-    assert(bits >= 0 && bits <= 112);
-    assert(max_correct >= 0 && max_correct <= MODES_MAX_BITERRORS);
-    assert(max_detect >= max_correct);
+    int i;
 
-    if (!max_correct)
+    for (i = 0; i < 256; ++i)
     {
-        *size_out = 0;
-        return NULL;
-    }
+        uint32_t c = (uint32_t)i << 24;
+        int j;
+        for (j = 0; j < 8; ++j)
+        {
+            if (c & 0x80000000)
+                c = (c << 1) ^ (MODES_GENERATOR_POLY << 8);
+            else
+                c = (c << 1);
+        }
 
-    maxsize = 0;
-    for (i = 1; i <= max_correct; ++i)
-    {
-        maxsize += combinations(bits - 5, i); // space needed for all i-bit errors
+        crc_table[0][i] = c;
     }
 
-    table = malloc(maxsize * sizeof(struct errorinfo));
-    base_entry.syndrome = 0;
-    base_entry.errors = 0;
-    for (i = 0; i < MODES_MAX_BITERRORS; ++i)
+    for (i = 0; i < 256; ++i)
     {
-        base_entry.bit[i] = -1;
+        for (int k = 1; k < 4; ++k)
+        {
+            uint32_t c = crc_table[k - 1][i];
+            crc_table[k][i] = (c << 8) ^ crc_table[0][c >> 24];
+        }
     }
 
-    // ignore the first 5 bits (DF type)
-    usedsize = prepare_subtable(table, 0, maxsize, 112 - bits, 5, bits, &base_entry, 0, max_correct);
-    qsort(table, usedsize, sizeof(struct errorinfo), syndrome_compare);
+    crc_bytes = crc_slice4;
+#ifdef CRC_HAVE_CLMUL
+    if (crc_clmul_supported())
+        crc_bytes = crc_clmul;
+#endif
+}
 
-    // Handle ambiguous cases, where there is more than one possible error pattern
-    // that produces a given syndrome (this happens with >2 bit errors).
-    for (i = 0, j = 0; i < usedsize; ++i)
-    {
-        if (i < usedsize - 1 && table[i + 1].syndrome == table[i].syndrome)
-        {
-            // skip over this entry and all collisions
-            while (i < usedsize && table[i + 1].syndrome == table[i].syndrome)
-                ++i;
+uint32_t modes_checksum(uint8_t *message, int bits)
+{
+    int n = bits / 8;
 
-            // now table[i] is the last duplicate
-            continue;
-        }
+    assert(bits % 8 == 0);
+    assert(n >= 3);
 
-        if (i != j)
-            table[j] = table[i];
-        ++j;
-    }
+    return crc_bytes(message, n - 3) ^ (message[n - 3] << 16) ^ (message[n - 2] << 8) ^ (message[n - 1]);
+}
 
-    if (j < usedsize)
-    {
-        usedsize = j;
-    }
+// Error tables for the selected correction level (see crc_tables.h),
+// or NULL when error correction is disabled
+static const struct syndrome_hash *bitErrorTable_short;
+static const struct syndrome_hash *bitErrorTable_long;
 
-    // Flag collisions we want to detect but not correct
-    if (max_detect > max_correct)
-    {
-        int flagged;
-        flagged = flag_collisions(table, usedsize, 112 - bits, 5, bits, 0, 1, max_correct + 1, max_detect);
+static inline const struct errorinfo *syndrome_hash_find(const struct syndrome_hash *h, uint32_t syndrome)
+{
+    const struct errorinfo *e;
 
-        if (flagged > 0)
-        {
-            for (i = 0, j = 0; i < usedsize; ++i)
-            {
-                if (table[i].errors != -1)
-                {
-                    if (i != j)
-                        table[j] = table[i];
-                    ++j;
-                }
-            }
-            usedsize = j;
-        }
-    }
+    e = &h->slots[syndrome_slot(syndrome, h->seed1, h->bits)];
+    if (e->syndrome == syndrome)
+        return e;
+
+    e = &h->slots[syndrome_slot(syndrome, h->seed2, h->bits)];
+    if (e->syndrome == syndrome)
+        return e;
 
-    *size_out = usedsize;
-    return table;
+    return NULL;
 }
 
-// Precompute syndrome tables for 56- and 112-bit messages.
+// Select the syndrome tables for 56- and 112-bit messages.
 
 void modes_checksum_init(int fixBits)
 {
     init_lookup_tables();
 
-    switch (fixBits)
+    if (fixBits <= 0)
     {
-    case 0:
         bitErrorTable_short = bitErrorTable_long = NULL;
-        bitErrorTableSize_short = bitErrorTableSize_long = 0;
-        break;
-
-    case 1:
-        // For 1 bit correction, we have 100% coverage up to 4 bit detection, so don't bother
-        // with flagging collisions there.
-        bitErrorTable_short = prepare_error_table(MODES_SHORT_MSG_BITS, 1, 1, &bitErrorTableSize_short);
-        bitErrorTable_long = prepare_error_table(MODES_LONG_MSG_BITS, 1, 1, &bitErrorTableSize_long);
-        break;
-
-    default:
-        // Detect out to 4 bit errors; this reduces our 2-bit coverage to about 65%.
-        // This can take a little while - tell the user.
-        bitErrorTable_short = prepare_error_table(MODES_SHORT_MSG_BITS, 2, 4, &bitErrorTableSize_short);
-        bitErrorTable_long = prepare_error_table(MODES_LONG_MSG_BITS, 2, 4, &bitErrorTableSize_long);
-        break;
+        return;
     }
+
+    if (fixBits > MODES_MAX_BITERRORS)
+        fixBits = MODES_MAX_BITERRORS;
+
+    bitErrorTable_short = &crc_error_tables[fixBits - 1][0];
+    bitErrorTable_long = &crc_error_tables[fixBits - 1][1];
 }
 
 // Given an error syndrome and message length, return
 // an error-correction descriptor, or NULL if the
 // syndrome is uncorrectable
 
-struct errorinfo *modes_checksum_diagnose(uint32_t syndrome, int bitlen)
+const struct errorinfo *modes_checksum_diagnose(uint32_t syndrome, int bitlen)
 {
-    struct errorinfo *table;
-    int tablesize;
-
-    struct errorinfo ei;
+    const struct syndrome_hash *h;
 
     if (syndrome == 0)
         return &NO_ERRORS;
 
     assert(bitlen == 56 || bitlen == 112);
-    if (bitlen == 56)
-    {
-        table = bitErrorTable_short;
-        tablesize = bitErrorTableSize_short;
-    }
-    else
-    {
-        table = bitErrorTable_long;
-        tablesize = bitErrorTableSize_long;
-    }
+    h = (bitlen == 56) ? bitErrorTable_short : bitErrorTable_long;
 
-    if (!table)
+    if (!h)
         return NULL;
 
-    ei.syndrome = syndrome;
-    return bsearch(&ei, table, tablesize, sizeof(struct errorinfo), syndrome_compare);
+    return syndrome_hash_find(h, syndrome);
 }
 
 // Given a message and an error-correction descriptor,
 // apply the error correction to the given message.
 
-void modes_checksum_fix(uint8_t *msg, struct errorinfo *info)
+void modes_checksum_fix(uint8_t *msg, const struct errorinfo *info)
 {
     int i;
 
@@ -340,12 +272,9 @@ void modes_checksum_fix(uint8_t *msg, struct errorinfo *info)
 /*
  * Clean CRC LUTs on exit.
  *
+ * The error tables are static data; just stop using them.
  */
 void crc_cleanup_tables(void)
 {
-    if (bitErrorTable_short != NULL)
-        free(bitErrorTable_short);
-
-    if (bitErrorTable_long != NULL)
-        free(bitErrorTable_long);
+    bitErrorTable_short = bitErrorTable_long = NULL;
 }
@@ -0,0 +1,411 @@
+/* Build-time generator for the Mode S error-correction tables.
+ *
+ * Usage: crc_gen <output.c>
+ *
+ * Builds the syndrome tables for 1- and 2-bit correction of 56- and 112-bit
+ * messages (the 2-bit tables also flag collisions with 3- and 4-bit errors),
+ * hashes them, and writes them out as const arrays (see crc_tables.h).
+ */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "readsb_def.h"
+#include "crc.h"
+#include "crc_tables.h"
+
+// Syndrome values for all single-bit errors in a 112-bit message
+static uint32_t single_bit_syndrome[112];
+
+// Bitwise CRC; speed doesn't matter here
+static uint32_t checksum(const uint8_t *msg, int bits)
+{
+    uint32_t rem = 0;
+    int n = bits / 8;
+
+    for (int i = 0; i < n - 3; ++i)
+    {
+        rem ^= (uint32_t)msg[i] << 16;
+        for (int j = 0; j < 8; ++j)
+        {
+            if (rem & 0x800000)
+                rem = (rem << 1) ^ MODES_GENERATOR_POLY;
+            else
+                rem = (rem << 1);
+        }
+        rem &= 0xffffff;
+    }
+
+    return rem ^ (msg[n - 3] << 16) ^ (msg[n - 2] << 8) ^ msg[n - 1];
+}
+
+static void init_single_bit_syndromes()
+{
+    uint8_t msg[112 / 8];
+
+    memset(msg, 0, sizeof(msg));
+    for (int i = 0; i < 112; ++i)
+    {
+        msg[i / 8] ^= 1 << (7 - (i & 7));
+        single_bit_syndrome[i] = checksum(msg, 112);
+        msg[i / 8] ^= 1 << (7 - (i & 7));
+    }
+}
+
+// compare two errorinfo structures
+
+static int syndrome_compare(const void *x, const void *y)
+{
+    struct errorinfo *ex = (struct errorinfo *)x;
+    struct errorinfo *ey = (struct errorinfo *)y;
+    return (int)ex->syndrome - (int)ey->syndrome;
+}
+
+// (n k), the number of ways of selecting k distinct items from a set of n items
+
+static int combinations(int n, int k)
+{
+    int result = 1, i;
+
+    if (k == 0 || k == n)
+        return 1;
+
+    if (k > n)
+        return 0;
+
+    for (i = 1; i <= k; ++i)
+    {
+        result = result * n / i;
+        n = n - 1;
+    }
+
+    return result;
+}
+
+// Recursively populates an errorinfo table with error syndromes
+//
+// in:
+//   table:      the table to fill
+//   n:          first entry to fill
+//   maxSize:    max size of table
+//   offset:     start bit offset for checksum calculation
+//   startbit:   first bit to introduce errors into
+//   endbit:     (one past) last bit to introduce errors info
+//   base_entry: template entry to start from
+//   error_bit:  how many error bits have already been set
+//   max_errors: maximum total error bits to set
+// out:
+//   returns:    the next free entry in the table
+//   table:      has been populated between [n, return value)
+
+static int prepare_subtable(struct errorinfo *table, int n, int maxsize, int offset, int startbit, int endbit, struct errorinfo *base_entry, int error_bit, int max_errors)
+{
+    int i = 0;
+
+    if (error_bit >= max_errors || error_bit >= MODES_MAX_BITERRORS)
+        return n;
+
+    for (i = startbit; i < endbit; ++i)
+    {
+        assert(n < maxsize);
+
+        table[n] = *base_entry;
+        table[n].syndrome ^= single_bit_syndrome[i + offset];
+        table[n].errors = error_bit + 1;
+        table[n].bit[error_bit] = i;
+
+        ++n;
+        n = prepare_subtable(table, n, maxsize, offset, i + 1, endbit, &table[n - 1], error_bit + 1, max_errors);
+    }
+
+    return n;
+}
+
+static int flag_collisions(struct errorinfo *table, int tablesize, int offset, int startbit, int endbit, uint32_t base_syndrome, int error_bit, int first_error, int last_error)
+{
+    int i = 0;
+    int count = 0;
+
+    if (error_bit > last_error)
+        return 0;
+
+    for (i = startbit; i < endbit; ++i)
+    {
+        struct errorinfo ei;
+
+        ei.syndrome = base_syndrome ^ single_bit_syndrome[i + offset];
+
+        if (error_bit >= first_error)
+        {
+            struct errorinfo *collision = bsearch(&ei, table, tablesize, sizeof(struct errorinfo), syndrome_compare);
+            if (collision != NULL && collision->errors != -1)
+            {
+                ++count;
+                collision->errors = -1;
+            }
+        }
+
+        count += flag_collisions(table, tablesize, offset, i + 1, endbit, ei.syndrome, error_bit + 1, first_error, last_error);
+    }
+
+    return count;
+}
+
+// Allocate and build an error table for messages of length "bits" (max 112)
+// returns a pointer to the new table and sets *size_out to the table length
+
+static struct errorinfo *prepare_error_table(int bits, int max_correct, int max_detect, int *size_out)
+{
+    int maxsize, usedsize;
+    struct errorinfo *table;
+    struct errorinfo base_entry;
+    int i, j;
+
+    assert(bits >= 0 && bits <= 112);
+    assert(max_correct >= 0 && max_correct <= MODES_MAX_BITERRORS);
+    assert(max_detect >= max_correct);
+
+    if (!max_correct)
+    {
+        *size_out = 0;
+        return NULL;
+    }
+
+    maxsize = 0;
+    for (i = 1; i <= max_correct; ++i)
+    {
+        maxsize += combinations(bits - 5, i); // space needed for all i-bit errors
+    }
+
+    table = malloc(maxsize * sizeof(struct errorinfo));
+    base_entry.syndrome = 0;
+    base_entry.errors = 0;
+    for (i = 0; i < MODES_MAX_BITERRORS; ++i)
+    {
+        base_entry.bit[i] = -1;
+    }
+
+    // ignore the first 5 bits (DF type)
+    usedsize = prepare_subtable(table, 0, maxsize, 112 - bits, 5, bits, &base_entry, 0, max_correct);
+    qsort(table, usedsize, sizeof(struct errorinfo), syndrome_compare);
+
+    // Handle ambiguous cases, where there is more than one possible error pattern
+    // that produces a given syndrome (this happens with >2 bit errors).
+    for (i = 0, j = 0; i < usedsize; ++i)
+    {
+        if (i < usedsize - 1 && table[i + 1].syndrome == table[i].syndrome)
+        {
+            // skip over this entry and all collisions
+            while (i < usedsize && table[i + 1].syndrome == table[i].syndrome)
+                ++i;
+
+            // now table[i] is the last duplicate
+            continue;
+        }
+
+        if (i != j)
+            table[j] = table[i];
+        ++j;
+    }
+
+    if (j < usedsize)
+    {
+        usedsize = j;
+    }
+
+    // Flag collisions we want to detect but not correct
+    if (max_detect > max_correct)
+    {
+        int flagged;
+        flagged = flag_collisions(table, usedsize, 112 - bits, 5, bits, 0, 1, max_correct + 1, max_detect);
+
+        if (flagged > 0)
+        {
+            for (i = 0, j = 0; i < usedsize; ++i)
+            {
+                if (table[i].errors != -1)
+                {
+                    if (i != j)
+                        table[j] = table[i];
+                    ++j;
+                }
+            }
+            usedsize = j;
+        }
+    }
+
+    *size_out = usedsize;
+    return table;
+}
+
+struct build_hash
+{
+    struct errorinfo *slots;
+    unsigned bits;
+    uint32_t seed1;
+    uint32_t seed2;
+};
+
+// Try to place all entries with the current seeds; returns 0 if the
+// insertion ran into a cycle and the hash has to be rebuilt.
+static int syndrome_hash_fill(struct build_hash *h, const struct errorinfo *table, int size)
+{
+    memset(h->slots, 0, ((size_t)1 << h->bits) * sizeof(struct errorinfo));
+
+    for (int i = 0; i < size; ++i)
+    {
+        struct errorinfo cur = table[i];
+        uint32_t slot = syndrome_slot(cur.syndrome, h->seed1, h->bits);
+
+        for (int kicks = 0;; ++kicks)
+        {
+            struct errorinfo evicted = h->slots[slot];
+
+            h->slots[slot] = cur;
+            if (evicted.syndrome == 0)
+                break;
+
+            if (kicks > 500)
+                return 0;
+
+            // move the evicted entry to its other slot
+            cur = evicted;
+            if (slot == syndrome_slot(cur.syndrome, h->seed1, h->bits))
+                slot = syndrome_slot(cur.syndrome, h->seed2, h->bits);
+            else
+                slot = syndrome_slot(cur.syndrome, h->seed1, h->bits);
+        }
+    }
+
+    return 1;
+}
+
+// Build a hash over a table of distinct, nonzero syndromes.
+static int syndrome_hash_build(struct build_hash *h, const struct errorinfo *table, int size)
+{
+    unsigned bits = 4;
+
+    while ((1U << bits) < 2 * (uint32_t)size)
+        ++bits;
+
+    h->seed1 = 0x9e3779b1U;
+    h->seed2 = 0x85ebca77U;
+
+    for (int attempt = 0; attempt < 64; ++attempt)
+    {
+        if (!(h->slots = malloc(((size_t)1 << bits) * sizeof(struct errorinfo))))
+            return 0;
+        h->bits = bits;
+
+        if (syndrome_hash_fill(h, table, size))
+            return 1;
+
+        // unlucky: new seeds, and more room every few attempts
+        free(h->slots);
+        h->slots = NULL;
+        h->seed1 += 0x6a09e668U;
+        h->seed2 += 0xbb67ae86U;
+        h->seed1 |= 1;
+        h->seed2 |= 1;
+        if (attempt % 8 == 7)
+            ++bits;
+    }
+
+    return 0;
+}
+
+static void write_table(FILE *out, const char *name, int bits, int max_correct, int max_detect, struct build_hash *h)
+{
+    struct errorinfo *table;
+    int size;
+
+    table = prepare_error_table(bits, max_correct, max_detect, &size);
+    if (!table || !syndrome_hash_build(h, table, size))
+    {
+        fprintf(stderr, "crc_gen: failed to build %s\n", name);
+        exit(1);
+    }
+    free(table);
+
+    fprintf(out, "// %d-bit messages, correct %d, detect %d: %d syndromes\n", bits, max_correct, max_detect, size);
+    fprintf(out, "static const struct errorinfo %s[%u] = {\n", name, 1U << h->bits);
+    for (uint32_t i = 0; i < (1U << h->bits); ++i)
+    {
+        const struct errorinfo *e = &h->slots[i];
+        fprintf(out, "%s{0x%06x, %d, {%d, %d}},%s", (i % 4) ? " " : "    ",
+                e->syndrome, e->errors, e->bit[0], e->bit[1], (i % 4 == 3) ? "\n" : "");
+    }
+    fprintf(out, "};\n\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const struct
+    {
+        const char *name;
+        int bits, max_correct, max_detect;
+    } tables[MODES_MAX_BITERRORS][2] = {
+        // For 1 bit correction, we have 100% coverage up to 4 bit detection, so don't bother
+        // with flagging collisions there.
+        {{"fix1_short", MODES_SHORT_MSG_BITS, 1, 1}, {"fix1_long", MODES_LONG_MSG_BITS, 1, 1}},
+        // Detect out to 4 bit errors; this reduces our 2-bit coverage to about 65%.
+        {{"fix2_short", MODES_SHORT_MSG_BITS, 2, 4}, {"fix2_long", MODES_LONG_MSG_BITS, 2, 4}},
+    };
+    struct build_hash hashes[MODES_MAX_BITERRORS][2];
+    char tmp_name[4096];
+    FILE *out;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <output.c>\n", argv[0]);
+        return 1;
+    }
+
+    // Write next to the output and rename it into place when complete, so an
+    // interrupted run never leaves a truncated table behind.
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", argv[1]) >= (int)sizeof(tmp_name))
+    {
+        fprintf(stderr, "%s: output path too long\n", argv[0]);
+        return 1;
+    }
+
+    if (!(out = fopen(tmp_name, "w")))
+    {
+        perror(tmp_name);
+        return 1;
+    }
+
+    init_single_bit_syndromes();
+
+    fprintf(out, "/* Generated by crc_gen - do not edit */\n\n#include \"crc_tables.h\"\n\n");
+    for (int i = 0; i < MODES_MAX_BITERRORS; ++i)
+        for (int j = 0; j < 2; ++j)
+            write_table(out, tables[i][j].name, tables[i][j].bits, tables[i][j].max_correct, tables[i][j].max_detect, &hashes[i][j]);
+
+    fprintf(out, "const struct syndrome_hash crc_error_tables[MODES_MAX_BITERRORS][2] = {\n");
+    for (int i = 0; i < MODES_MAX_BITERRORS; ++i)
+    {
+        fprintf(out, "    {\n");
+        for (int j = 0; j < 2; ++j)
+            fprintf(out, "        {%s, %u, 0x%08xU, 0x%08xU},\n", tables[i][j].name, hashes[i][j].bits, hashes[i][j].seed1, hashes[i][j].seed2);
+        fprintf(out, "    },\n");
+    }
+    fprintf(out, "};\n");
+
+    if (ferror(out) | fclose(out))
+    {
+        perror(tmp_name);
+        remove(tmp_name);
+        return 1;
+    }
+
+    if (rename(tmp_name, argv[1]) != 0)
+    {
+        perror(argv[1]);
+        remove(tmp_name);
+        return 1;
+    }
+
+    return 0;
+}
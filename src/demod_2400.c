@@ -8,6 +8,9 @@
 #include "mode_ac.h"
 #include "util.h"
 #include "fifo.h"
+#include "demod_capture.h"
+#include "trace.h"
+#include "track.h"
 #include "demod_2400.h"
 
 /* 2.4MHz sampling rate version
@@ -53,6 +56,257 @@ static inline int slice_phase4(uint16_t *m)
     return m[0] + 5 * m[1] - 5 * m[2] - m[3];
 }
 
+// Returns 1 and sets *high_out to the estimated pulse level if there is a
+// plausible Mode S preamble at preamble[0].
+static int check_preamble(uint16_t *preamble, int *high_out)
+{
+    int high;
+    uint32_t base_signal, base_noise;
+
+    // Look for a message starting at around sample 0 with phase offset 3..7
+
+    // Ideal sample values for preambles with different phase
+    // Xn is the first data symbol with phase offset N
+    //
+    // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+    // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
+    // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
+    // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
+    // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
+    // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
+    //
+
+    // quick check: we must have a rising edge 0->1 and a falling edge 12->13
+    if (!(preamble[0] < preamble[1] && preamble[12] > preamble[13]))
+        return 0;
+
+    if (preamble[1] > preamble[2] &&                               // 1
+        preamble[2] < preamble[3] && preamble[3] > preamble[4] &&  // 3
+        preamble[8] < preamble[9] && preamble[9] > preamble[10] && // 9
+        preamble[10] < preamble[11])
+    { // 11-12
+        // peaks at 1,3,9,11-12: phase 3
+        high = (preamble[1] + preamble[3] + preamble[9] + preamble[11] + preamble[12]) / 4;
+        base_signal = preamble[1] + preamble[3] + preamble[9];
+        base_noise = preamble[5] + preamble[6] + preamble[7];
+    }
+    else if (preamble[1] > preamble[2] &&                               // 1
+             preamble[2] < preamble[3] && preamble[3] > preamble[4] &&  // 3
+             preamble[8] < preamble[9] && preamble[9] > preamble[10] && // 9
+             preamble[11] < preamble[12])
+    { // 12
+        // peaks at 1,3,9,12: phase 4
+        high = (preamble[1] + preamble[3] + preamble[9] + preamble[12]) / 4;
+        base_signal = preamble[1] + preamble[3] + preamble[9] + preamble[12];
+        base_noise = preamble[5] + preamble[6] + preamble[7] + preamble[8];
+    }
+    else if (preamble[1] > preamble[2] &&                                // 1
+             preamble[2] < preamble[3] && preamble[4] > preamble[5] &&   // 3-4
+             preamble[8] < preamble[9] && preamble[10] > preamble[11] && // 9-10
+             preamble[11] < preamble[12])
+    { // 12
+        // peaks at 1,3-4,9-10,12: phase 5
+        high = (preamble[1] + preamble[3] + preamble[4] + preamble[9] + preamble[10] + preamble[12]) / 4;
+        base_signal = preamble[1] + preamble[12];
+        base_noise = preamble[6] + preamble[7];
+    }
+    else if (preamble[1] > preamble[2] &&                                 // 1
+             preamble[3] < preamble[4] && preamble[4] > preamble[5] &&    // 4
+             preamble[9] < preamble[10] && preamble[10] > preamble[11] && // 10
+             preamble[11] < preamble[12])
+    { // 12
+        // peaks at 1,4,10,12: phase 6
+        high = (preamble[1] + preamble[4] + preamble[10] + preamble[12]) / 4;
+        base_signal = preamble[1] + preamble[4] + preamble[10] + preamble[12];
+        base_noise = preamble[5] + preamble[6] + preamble[7] + preamble[8];
+    }
+    else if (preamble[2] > preamble[3] &&                                 // 1-2
+             preamble[3] < preamble[4] && preamble[4] > preamble[5] &&    // 4
+             preamble[9] < preamble[10] && preamble[10] > preamble[11] && // 10
+             preamble[11] < preamble[12])
+    { // 12
+        // peaks at 1-2,4,10,12: phase 7
+        high = (preamble[1] + preamble[2] + preamble[4] + preamble[10] + preamble[12]) / 4;
+        base_signal = preamble[4] + preamble[10] + preamble[12];
+        base_noise = preamble[6] + preamble[7] + preamble[8];
+    }
+    else
+    {
+        // no suitable peaks
+        return 0;
+    }
+
+    // Check for enough signal
+    if (base_signal * 2 < 3 * base_noise) // about 3.5dB SNR
+        return 0;
+
+    // Check that the "quiet" bits 6,7,15,16,17 are actually quiet
+    if (preamble[5] >= high ||
+        preamble[6] >= high ||
+        preamble[7] >= high ||
+        preamble[8] >= high ||
+        preamble[14] >= high ||
+        preamble[15] >= high ||
+        preamble[16] >= high ||
+        preamble[17] >= high ||
+        preamble[18] >= high)
+    {
+        return 0;
+    }
+
+    *high_out = high;
+    return 1;
+}
+
+// Demodulate the message following a preamble at m[0], trying all phases.
+// The best-scoring message is left in 'out', its checksum results in
+// *out_check and its phase in *bestphase.
+// Returns the best score (as for score_modes_message), or -2 if nothing useful was found.
+static int demod_best_phase(uint16_t *m, unsigned char *out, modes_score_t *out_check, int *bestphase)
+{
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+    modes_score_t check;
+    int bestscore = -2;
+    int try_phase;
+
+    *bestphase = -1;
+    for (try_phase = 4; try_phase <= 8; ++try_phase)
+    {
+        uint16_t *pPtr;
+        int phase, i, score, bytelen;
+
+        // Decode all the next 112 bits, regardless of the actual message
+        // size. We'll check the actual message type later
+
+        pPtr = &m[19] + (try_phase / 5);
+        phase = try_phase % 5;
+
+        bytelen = MODES_LONG_MSG_BYTES;
+        for (i = 0; i < bytelen; ++i)
+        {
+            uint8_t theByte = 0;
+
+            switch (phase)
+            {
+            case 0:
+                theByte =
+                    (slice_phase0(pPtr) > 0 ? 0x80 : 0) |
+                    (slice_phase2(pPtr + 2) > 0 ? 0x40 : 0) |
+                    (slice_phase4(pPtr + 4) > 0 ? 0x20 : 0) |
+                    (slice_phase1(pPtr + 7) > 0 ? 0x10 : 0) |
+                    (slice_phase3(pPtr + 9) > 0 ? 0x08 : 0) |
+                    (slice_phase0(pPtr + 12) > 0 ? 0x04 : 0) |
+                    (slice_phase2(pPtr + 14) > 0 ? 0x02 : 0) |
+                    (slice_phase4(pPtr + 16) > 0 ? 0x01 : 0);
+
+                phase = 1;
+                pPtr += 19;
+                break;
+
+            case 1:
+                theByte =
+                    (slice_phase1(pPtr) > 0 ? 0x80 : 0) |
+                    (slice_phase3(pPtr + 2) > 0 ? 0x40 : 0) |
+                    (slice_phase0(pPtr + 5) > 0 ? 0x20 : 0) |
+                    (slice_phase2(pPtr + 7) > 0 ? 0x10 : 0) |
+                    (slice_phase4(pPtr + 9) > 0 ? 0x08 : 0) |
+                    (slice_phase1(pPtr + 12) > 0 ? 0x04 : 0) |
+                    (slice_phase3(pPtr + 14) > 0 ? 0x02 : 0) |
+                    (slice_phase0(pPtr + 17) > 0 ? 0x01 : 0);
+
+                phase = 2;
+                pPtr += 19;
+                break;
+
+            case 2:
+                theByte =
+                    (slice_phase2(pPtr) > 0 ? 0x80 : 0) |
+                    (slice_phase4(pPtr + 2) > 0 ? 0x40 : 0) |
+                    (slice_phase1(pPtr + 5) > 0 ? 0x20 : 0) |
+                    (slice_phase3(pPtr + 7) > 0 ? 0x10 : 0) |
+                    (slice_phase0(pPtr + 10) > 0 ? 0x08 : 0) |
+                    (slice_phase2(pPtr + 12) > 0 ? 0x04 : 0) |
+                    (slice_phase4(pPtr + 14) > 0 ? 0x02 : 0) |
+                    (slice_phase1(pPtr + 17) > 0 ? 0x01 : 0);
+
+                phase = 3;
+                pPtr += 19;
+                break;
+
+            case 3:
+                theByte =
+                    (slice_phase3(pPtr) > 0 ? 0x80 : 0) |
+                    (slice_phase0(pPtr + 3) > 0 ? 0x40 : 0) |
+                    (slice_phase2(pPtr + 5) > 0 ? 0x20 : 0) |
+                    (slice_phase4(pPtr + 7) > 0 ? 0x10 : 0) |
+                    (slice_phase1(pPtr + 10) > 0 ? 0x08 : 0) |
+                    (slice_phase3(pPtr + 12) > 0 ? 0x04 : 0) |
+                    (slice_phase0(pPtr + 15) > 0 ? 0x02 : 0) |
+                    (slice_phase2(pPtr + 17) > 0 ? 0x01 : 0);
+
+                phase = 4;
+                pPtr += 19;
+                break;
+
+            case 4:
+                theByte =
+                    (slice_phase4(pPtr) > 0 ? 0x80 : 0) |
+                    (slice_phase1(pPtr + 3) > 0 ? 0x40 : 0) |
+                    (slice_phase3(pPtr + 5) > 0 ? 0x20 : 0) |
+                    (slice_phase0(pPtr + 8) > 0 ? 0x10 : 0) |
+                    (slice_phase2(pPtr + 10) > 0 ? 0x08 : 0) |
+                    (slice_phase4(pPtr + 12) > 0 ? 0x04 : 0) |
+                    (slice_phase1(pPtr + 15) > 0 ? 0x02 : 0) |
+                    (slice_phase3(pPtr + 17) > 0 ? 0x01 : 0);
+
+                phase = 0;
+                pPtr += 20;
+                break;
+            }
+
+            msg[i] = theByte;
+            if (i == 0)
+            {
+                switch (msg[0] >> 3)
+                {
+                case 0:
+                case 4:
+                case 5:
+                case 11:
+                    bytelen = MODES_SHORT_MSG_BYTES;
+                    break;
+
+                case 16:
+                case 17:
+                case 18:
+                case 20:
+                case 21:
+                case 24:
+                    break;
+
+                default:
+                    bytelen = 1; // unknown DF, give up immediately
+                    break;
+                }
+            }
+        }
+
+        // Score the mode S message and see if it's any good.
+        score = score_modes_message(msg, i * 8, &check);
+        if (score > bestscore || *bestphase < 0)
+        {
+            // new high score! (the first phase is always kept so a rejected
+            // candidate still has something to show for diagnostics)
+            memcpy(out, msg, MODES_LONG_MSG_BYTES);
+            *out_check = check;
+            bestscore = score;
+            *bestphase = try_phase;
+        }
+    }
+
+    return bestscore;
+}
+
 /* Given 'mlen' magnitude samples in 'm', sampled at 2.4MHz,
  * try to demodulate some Mode S messages.
  */
@@ -66,6 +320,9 @@ void demodulate_2400(struct mag_buf *mag)
     unsigned char *bestmsg;
     int bestscore, bestphase;
 
+    // checksum results for msg1 / msg2
+    modes_score_t check1, check2, *check, *bestcheck;
+
     // maximum lookahead we use
     assert(mag->overlap >= 19 + 1 + 269);
 
@@ -74,248 +331,31 @@ void demodulate_2400(struct mag_buf *mag)
 
     uint64_t sum_scaled_signal_power = 0;
 
+    uint64_t demod_start = ustime();
+    if (mag->readyTimestamp)
+        latency_hist_add(&lib_state.stats_current.latency_block_to_demod, demod_start - mag->readyTimestamp);
+
     msg = msg1;
+    check = &check1;
 
     for (j = 0; j < mlen; j++)
     {
         uint16_t *preamble = &m[j];
         int high;
-        uint32_t base_signal, base_noise;
-        int try_phase;
         int msglen;
 
-        // Look for a message starting at around sample 0 with phase offset 3..7
-
-        // Ideal sample values for preambles with different phase
-        // Xn is the first data symbol with phase offset N
-        //
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
-        // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
-        // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
-        // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
-        // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
-        //
-
-        // quick check: we must have a rising edge 0->1 and a falling edge 12->13
-        if (!(preamble[0] < preamble[1] && preamble[12] > preamble[13]))
-            continue;
-
-        if (preamble[1] > preamble[2] &&                               // 1
-            preamble[2] < preamble[3] && preamble[3] > preamble[4] &&  // 3
-            preamble[8] < preamble[9] && preamble[9] > preamble[10] && // 9
-            preamble[10] < preamble[11])
-        { // 11-12
-            // peaks at 1,3,9,11-12: phase 3
-            high = (preamble[1] + preamble[3] + preamble[9] + preamble[11] + preamble[12]) / 4;
-            base_signal = preamble[1] + preamble[3] + preamble[9];
-            base_noise = preamble[5] + preamble[6] + preamble[7];
-        }
-        else if (preamble[1] > preamble[2] &&                               // 1
-                 preamble[2] < preamble[3] && preamble[3] > preamble[4] &&  // 3
-                 preamble[8] < preamble[9] && preamble[9] > preamble[10] && // 9
-                 preamble[11] < preamble[12])
-        { // 12
-            // peaks at 1,3,9,12: phase 4
-            high = (preamble[1] + preamble[3] + preamble[9] + preamble[12]) / 4;
-            base_signal = preamble[1] + preamble[3] + preamble[9] + preamble[12];
-            base_noise = preamble[5] + preamble[6] + preamble[7] + preamble[8];
-        }
-        else if (preamble[1] > preamble[2] &&                                // 1
-                 preamble[2] < preamble[3] && preamble[4] > preamble[5] &&   // 3-4
-                 preamble[8] < preamble[9] && preamble[10] > preamble[11] && // 9-10
-                 preamble[11] < preamble[12])
-        { // 12
-            // peaks at 1,3-4,9-10,12: phase 5
-            high = (preamble[1] + preamble[3] + preamble[4] + preamble[9] + preamble[10] + preamble[12]) / 4;
-            base_signal = preamble[1] + preamble[12];
-            base_noise = preamble[6] + preamble[7];
-        }
-        else if (preamble[1] > preamble[2] &&                                 // 1
-                 preamble[3] < preamble[4] && preamble[4] > preamble[5] &&    // 4
-                 preamble[9] < preamble[10] && preamble[10] > preamble[11] && // 10
-                 preamble[11] < preamble[12])
-        { // 12
-            // peaks at 1,4,10,12: phase 6
-            high = (preamble[1] + preamble[4] + preamble[10] + preamble[12]) / 4;
-            base_signal = preamble[1] + preamble[4] + preamble[10] + preamble[12];
-            base_noise = preamble[5] + preamble[6] + preamble[7] + preamble[8];
-        }
-        else if (preamble[2] > preamble[3] &&                                 // 1-2
-                 preamble[3] < preamble[4] && preamble[4] > preamble[5] &&    // 4
-                 preamble[9] < preamble[10] && preamble[10] > preamble[11] && // 10
-                 preamble[11] < preamble[12])
-        { // 12
-            // peaks at 1-2,4,10,12: phase 7
-            high = (preamble[1] + preamble[2] + preamble[4] + preamble[10] + preamble[12]) / 4;
-            base_signal = preamble[4] + preamble[10] + preamble[12];
-            base_noise = preamble[6] + preamble[7] + preamble[8];
-        }
-        else
-        {
-            // no suitable peaks
-            continue;
-        }
-
-        // Check for enough signal
-        if (base_signal * 2 < 3 * base_noise) // about 3.5dB SNR
+        if (!check_preamble(preamble, &high))
             continue;
 
-        // Check that the "quiet" bits 6,7,15,16,17 are actually quiet
-        if (preamble[5] >= high ||
-            preamble[6] >= high ||
-            preamble[7] >= high ||
-            preamble[8] >= high ||
-            preamble[14] >= high ||
-            preamble[15] >= high ||
-            preamble[16] >= high ||
-            preamble[17] >= high ||
-            preamble[18] >= high)
-        {
-            continue;
-        }
+        READSB_TRACE2(demod_preamble, mag->sampleTimestamp + j * 5, high);
 
         // try all phases
         lib_state.stats_current.demod_preambles++;
-        bestmsg = NULL;
-        bestscore = -2;
-        bestphase = -1;
-        for (try_phase = 4; try_phase <= 8; ++try_phase)
-        {
-            uint16_t *pPtr;
-            int phase, i, score, bytelen;
-
-            // Decode all the next 112 bits, regardless of the actual message
-            // size. We'll check the actual message type later
-
-            pPtr = &m[j + 19] + (try_phase / 5);
-            phase = try_phase % 5;
-
-            bytelen = MODES_LONG_MSG_BYTES;
-            for (i = 0; i < bytelen; ++i)
-            {
-                uint8_t theByte = 0;
-
-                switch (phase)
-                {
-                case 0:
-                    theByte =
-                        (slice_phase0(pPtr) > 0 ? 0x80 : 0) |
-                        (slice_phase2(pPtr + 2) > 0 ? 0x40 : 0) |
-                        (slice_phase4(pPtr + 4) > 0 ? 0x20 : 0) |
-                        (slice_phase1(pPtr + 7) > 0 ? 0x10 : 0) |
-                        (slice_phase3(pPtr + 9) > 0 ? 0x08 : 0) |
-                        (slice_phase0(pPtr + 12) > 0 ? 0x04 : 0) |
-                        (slice_phase2(pPtr + 14) > 0 ? 0x02 : 0) |
-                        (slice_phase4(pPtr + 16) > 0 ? 0x01 : 0);
-
-                    phase = 1;
-                    pPtr += 19;
-                    break;
-
-                case 1:
-                    theByte =
-                        (slice_phase1(pPtr) > 0 ? 0x80 : 0) |
-                        (slice_phase3(pPtr + 2) > 0 ? 0x40 : 0) |
-                        (slice_phase0(pPtr + 5) > 0 ? 0x20 : 0) |
-                        (slice_phase2(pPtr + 7) > 0 ? 0x10 : 0) |
-                        (slice_phase4(pPtr + 9) > 0 ? 0x08 : 0) |
-                        (slice_phase1(pPtr + 12) > 0 ? 0x04 : 0) |
-                        (slice_phase3(pPtr + 14) > 0 ? 0x02 : 0) |
-                        (slice_phase0(pPtr + 17) > 0 ? 0x01 : 0);
-
-                    phase = 2;
-                    pPtr += 19;
-                    break;
-
-                case 2:
-                    theByte =
-                        (slice_phase2(pPtr) > 0 ? 0x80 : 0) |
-                        (slice_phase4(pPtr + 2) > 0 ? 0x40 : 0) |
-                        (slice_phase1(pPtr + 5) > 0 ? 0x20 : 0) |
-                        (slice_phase3(pPtr + 7) > 0 ? 0x10 : 0) |
-                        (slice_phase0(pPtr + 10) > 0 ? 0x08 : 0) |
-                        (slice_phase2(pPtr + 12) > 0 ? 0x04 : 0) |
-                        (slice_phase4(pPtr + 14) > 0 ? 0x02 : 0) |
-                        (slice_phase1(pPtr + 17) > 0 ? 0x01 : 0);
-
-                    phase = 3;
-                    pPtr += 19;
-                    break;
-
-                case 3:
-                    theByte =
-                        (slice_phase3(pPtr) > 0 ? 0x80 : 0) |
-                        (slice_phase0(pPtr + 3) > 0 ? 0x40 : 0) |
-                        (slice_phase2(pPtr + 5) > 0 ? 0x20 : 0) |
-                        (slice_phase4(pPtr + 7) > 0 ? 0x10 : 0) |
-                        (slice_phase1(pPtr + 10) > 0 ? 0x08 : 0) |
-                        (slice_phase3(pPtr + 12) > 0 ? 0x04 : 0) |
-                        (slice_phase0(pPtr + 15) > 0 ? 0x02 : 0) |
-                        (slice_phase2(pPtr + 17) > 0 ? 0x01 : 0);
-
-                    phase = 4;
-                    pPtr += 19;
-                    break;
-
-                case 4:
-                    theByte =
-                        (slice_phase4(pPtr) > 0 ? 0x80 : 0) |
-                        (slice_phase1(pPtr + 3) > 0 ? 0x40 : 0) |
-                        (slice_phase3(pPtr + 5) > 0 ? 0x20 : 0) |
-                        (slice_phase0(pPtr + 8) > 0 ? 0x10 : 0) |
-                        (slice_phase2(pPtr + 10) > 0 ? 0x08 : 0) |
-                        (slice_phase4(pPtr + 12) > 0 ? 0x04 : 0) |
-                        (slice_phase1(pPtr + 15) > 0 ? 0x02 : 0) |
-                        (slice_phase3(pPtr + 17) > 0 ? 0x01 : 0);
-
-                    phase = 0;
-                    pPtr += 20;
-                    break;
-                }
-
-                msg[i] = theByte;
-                if (i == 0)
-                {
-                    switch (msg[0] >> 3)
-                    {
-                    case 0:
-                    case 4:
-                    case 5:
-                    case 11:
-                        bytelen = MODES_SHORT_MSG_BYTES;
-                        break;
-
-                    case 16:
-                    case 17:
-                    case 18:
-                    case 20:
-                    case 21:
-                    case 24:
-                        break;
-
-                    default:
-                        bytelen = 1; // unknown DF, give up immediately
-                        break;
-                    }
-                }
-            }
-
-            // Score the mode S message and see if it's any good.
-            score = score_modes_message(msg, i * 8);
-            if (score > bestscore)
-            {
-                // new high score!
-                bestmsg = msg;
-                bestscore = score;
-                bestphase = try_phase;
-
-                // swap to using the other buffer so we don't clobber our demodulated data
-                // (if we find a better result then we'll swap back, but that's OK because
-                // we no longer need this copy if we found a better one)
-                msg = (msg == msg1) ? msg2 : msg1;
-            }
-        }
+        bestscore = demod_best_phase(preamble, msg, check, &bestphase);
+        bestmsg = msg;
+        bestcheck = check;
+        msg = (msg == msg1) ? msg2 : msg1;
+        check = (check == &check1) ? &check2 : &check1;
 
         // Do we have a candidate?
         if (bestscore < 0)
@@ -324,11 +364,47 @@ void demodulate_2400(struct mag_buf *mag)
                 lib_state.stats_current.demod_rejected_unknown_icao++;
             else
                 lib_state.stats_current.demod_rejected_bad++;
+            if (lib_state.config.demod_capture_size)
+                demod_capture_add(preamble, mag->sampleTimestamp + j * 5, bestphase, bestmsg, bestscore);
             continue; // nope.
         }
 
         msglen = modes_message_len_by_type(bestmsg[0] >> 3);
 
+        // Look for a stronger frame whose preamble starts inside this one
+        // (garbling); the usual skip below would otherwise step over it
+        if (lib_state.config.demod_overlap)
+        {
+            uint32_t end = j + msglen * 12 / 5;
+            uint32_t k;
+
+            for (k = j + 1; k < end && k < mlen; ++k)
+            {
+                int other_high, other_phase, other_score;
+
+                if (!check_preamble(&m[k], &other_high) || other_high < 2 * high)
+                    continue;
+
+                lib_state.stats_current.demod_preambles++;
+                other_score = demod_best_phase(&m[k], msg, check, &other_phase);
+                if (other_score <= bestscore)
+                    continue;
+
+                // the overlapping frame wins; carry on looking inside it
+                bestmsg = msg;
+                bestcheck = check;
+                msg = (msg == msg1) ? msg2 : msg1;
+                check = (check == &check1) ? &check2 : &check1;
+                bestscore = other_score;
+                bestphase = other_phase;
+                high = other_high;
+                j = k;
+                msglen = modes_message_len_by_type(bestmsg[0] >> 3);
+                end = j + msglen * 12 / 5;
+                lib_state.stats_current.demod_recovered++;
+            }
+        }
+
         // Set initial mm structure details
         mm = zeroMessage;
 
@@ -344,18 +420,22 @@ void demodulate_2400(struct mag_buf *mag)
 
         // Decode the received message
         {
-            int result = decode_modes_message(&mm, bestmsg);
+            int result = decode_modes_message(&mm, bestmsg, bestcheck);
             if (result < 0)
             {
                 if (result == -1)
                     lib_state.stats_current.demod_rejected_unknown_icao++;
                 else
                     lib_state.stats_current.demod_rejected_bad++;
+                if (lib_state.config.demod_capture_size)
+                    demod_capture_add(&m[j], mag->sampleTimestamp + j * 5, bestphase, bestmsg, result);
                 continue;
             }
             else
             {
                 lib_state.stats_current.demod_accepted[mm.correctedbits]++;
+                mm.decodedUs = ustime();
+                latency_hist_add(&lib_state.stats_current.latency_demod_to_decode, mm.decodedUs - demod_start);
             }
         }
 
@@ -393,6 +473,7 @@ void demodulate_2400(struct mag_buf *mag)
         j += msglen * 12 / 5;
 
         // Pass data to the next layer
+        READSB_TRACE3(demod_accept, mm.timestampMsg, mm.score, mm.addr);
         use_modes_message(&mm);
     }
 
@@ -402,6 +483,10 @@ void demodulate_2400(struct mag_buf *mag)
         lib_state.stats_current.noise_power_sum += (mag->mean_power * mlen - sum_signal_power);
         lib_state.stats_current.noise_power_count += mlen;
     }
+
+    if (lib_state.config.maintenance_budget)
+        track_maintenance_step();
+    latency_hist_add(&lib_state.stats_current.latency_block, ustime() - demod_start);
 }
 
 // Mode A/C bits are 1.45us wide, consisting of 0.45us on and 1.0us off
@@ -0,0 +1,184 @@
+#include "demod_capture.h"
+#include "readsb.h"
+#include "readsb_def.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define CAPTURE_MAGIC "RSBC"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 36
+
+struct capture_record
+{
+    uint64_t timestamp;
+    int16_t score;
+    int8_t phase;
+    uint8_t msg[MODES_LONG_MSG_BYTES];
+};
+
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER; // protects the ring
+static struct capture_record *capture_ring;                       // ring of records
+static uint16_t *capture_samples;                                 // 'capture_window' samples per record
+static unsigned capture_size;                                     // number of records in the ring
+static unsigned capture_window;                                   // samples kept per record
+static unsigned capture_rate;                                     // keep one in every 'capture_rate' offers
+static unsigned capture_head;                                     // next record to write
+static unsigned capture_count;                                    // number of unread records
+static unsigned capture_skip;                                     // offers left to skip, demodulator thread only
+
+bool demod_capture_init(unsigned size, unsigned rate, unsigned window)
+{
+    if (!(capture_ring = calloc(size, sizeof(capture_ring[0]))) ||
+        !(capture_samples = calloc((size_t)size * window, sizeof(capture_samples[0]))))
+    {
+        demod_capture_destroy();
+        return false;
+    }
+
+    capture_size = size;
+    capture_window = window;
+    capture_rate = rate ? rate : 1;
+    capture_head = capture_count = capture_skip = 0;
+    return true;
+}
+
+void demod_capture_destroy()
+{
+    free(capture_ring);
+    capture_ring = NULL;
+    free(capture_samples);
+    capture_samples = NULL;
+    capture_size = capture_count = 0;
+}
+
+void demod_capture_add(const uint16_t *m, uint64_t timestamp, int phase, const unsigned char *msg, int score)
+{
+    struct capture_record *rec;
+
+    if (capture_skip)
+    {
+        --capture_skip;
+        return;
+    }
+    capture_skip = capture_rate - 1;
+
+    // never stall the demodulator on a reader
+    if (pthread_mutex_trylock(&capture_mutex) != 0)
+        return;
+
+    rec = &capture_ring[capture_head];
+    rec->timestamp = timestamp;
+    rec->score = score;
+    rec->phase = phase;
+    memcpy(rec->msg, msg, MODES_LONG_MSG_BYTES);
+    memcpy(&capture_samples[(size_t)capture_head * capture_window], m, capture_window * sizeof(m[0]));
+
+    capture_head = (capture_head + 1) % capture_size;
+    if (capture_count < capture_size)
+        ++capture_count;
+
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+int readsb_demod_capture_read(readsb_demod_capture_t *rec, uint16_t *samples, unsigned max_samples)
+{
+    struct capture_record *r;
+    unsigned idx, n;
+
+    pthread_mutex_lock(&capture_mutex);
+    if (!capture_count)
+    {
+        pthread_mutex_unlock(&capture_mutex);
+        return 0;
+    }
+
+    // oldest record first
+    idx = (capture_head + capture_size - capture_count) % capture_size;
+    r = &capture_ring[idx];
+    rec->timestamp = r->timestamp;
+    rec->score = r->score;
+    rec->phase = r->phase;
+    memcpy(rec->msg, r->msg, sizeof(rec->msg));
+    rec->nsamples = capture_window;
+
+    n = (max_samples < capture_window) ? max_samples : capture_window;
+    if (samples && n)
+        memcpy(samples, &capture_samples[(size_t)idx * capture_window], n * sizeof(samples[0]));
+
+    --capture_count;
+    pthread_mutex_unlock(&capture_mutex);
+    return 1;
+}
+
+static unsigned char *put_le(unsigned char *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        *p++ = (v >> (8 * i)) & 0xFF;
+    return p;
+}
+
+int readsb_demod_capture_dump(const char *path)
+{
+    readsb_demod_capture_t rec;
+    unsigned char header[CAPTURE_HEADER_SIZE], *p;
+    uint16_t *samples;
+    unsigned char *raw;
+    unsigned window = capture_window;
+    int written = 0;
+    FILE *f;
+
+    if (!capture_ring)
+        return 0;
+
+    samples = malloc(window * sizeof(samples[0]));
+    raw = malloc(window * 2);
+    if (!samples || !raw)
+    {
+        free(samples);
+        free(raw);
+        return -1;
+    }
+
+    if (!(f = fopen(path, "ab")))
+    {
+        fprintf(stderr, "libreadsb: Can't open capture file %s\n", path);
+        free(samples);
+        free(raw);
+        return -1;
+    }
+
+    while (readsb_demod_capture_read(&rec, samples, window))
+    {
+        p = header;
+        memcpy(p, CAPTURE_MAGIC, 4);
+        p += 4;
+        *p++ = CAPTURE_VERSION;
+        *p++ = (uint8_t)(int8_t)rec.phase;
+        p = put_le(p, (uint16_t)(int16_t)rec.score, 2);
+        p = put_le(p, (uint32_t)lib_state.sample_rate, 4);
+        p = put_le(p, rec.timestamp, 8);
+        memcpy(p, rec.msg, sizeof(rec.msg));
+        p += sizeof(rec.msg);
+        put_le(p, rec.nsamples, 2);
+
+        for (unsigned i = 0; i < rec.nsamples; ++i)
+            put_le(raw + 2 * i, samples[i], 2);
+
+        if (fwrite(header, sizeof(header), 1, f) != 1 || fwrite(raw, 2, rec.nsamples, f) != rec.nsamples)
+        {
+            fprintf(stderr, "libreadsb: Error writing capture file %s\n", path);
+            written = -1;
+            break;
+        }
+        ++written;
+    }
+
+    if (fclose(f) != 0)
+        written = -1;
+    free(samples);
+    free(raw);
+    return written;
+}
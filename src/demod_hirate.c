@@ -0,0 +1,379 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "readsb_def.h"
+#include "mode_s.h"
+#include "util.h"
+#include "fifo.h"
+#include "demod_capture.h"
+#include "trace.h"
+#include "track.h"
+#include "demod_hirate.h"
+
+/* High sample rate version (6 - 24MHz, multiples of 2MHz)
+ *
+ * At these rates every Mode S chip (half a bit, 500ns) spans a whole number
+ * of samples 'h' (3 at 6MHz, 4 at 8MHz, 6 at 12MHz), so there is no need for
+ * the phase-dependent slicers used by the 2.4MHz demodulator: a bit is simply
+ * the comparison of the energy in its first and second chip.
+ *
+ * Preamble detection is a correlation against the ideal 8us preamble
+ *
+ *   chip:   0 1 2 3 4 5 6 7 8 9 0 1
+ *   value:  1 0 1 0 0 0 0 1 0 1 0 0
+ *
+ * evaluated on per-chip sums. The correlation peak is refined to a
+ * fraction of a sample with a parabolic fit, which is what gives the
+ * better timestamp resolution on the 12MHz clock.
+ */
+
+// Sum of the 'h' samples making up one chip
+static inline uint32_t chip_sum(const uint16_t *m, unsigned h)
+{
+    uint32_t sum = 0;
+    for (unsigned i = 0; i < h; ++i)
+        sum += m[i];
+    return sum;
+}
+
+// Pulse (P) and quiet (Q) chip energy of a preamble starting at m[0]
+static inline void preamble_energy(const uint16_t *m, unsigned h, uint32_t *pulse, uint32_t *quiet, uint32_t *quiet_max)
+{
+    static const uint8_t pulse_chips[4] = {0, 2, 7, 9};
+    static const uint8_t quiet_chips[8] = {1, 3, 4, 5, 6, 8, 10, 11};
+    uint32_t p = 0, q = 0, qmax = 0;
+
+    for (int i = 0; i < 4; ++i)
+        p += chip_sum(m + pulse_chips[i] * h, h);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        uint32_t c = chip_sum(m + quiet_chips[i] * h, h);
+        q += c;
+        if (c > qmax)
+            qmax = c;
+    }
+
+    *pulse = p;
+    *quiet = q;
+    *quiet_max = qmax;
+}
+
+// Correlation of the ideal preamble with the samples at m[0]:
+// mean pulse chip minus mean quiet chip, scaled by 8
+static inline int64_t preamble_correlation(const uint16_t *m, unsigned h)
+{
+    uint32_t p, q, qmax;
+    preamble_energy(m, h, &p, &q, &qmax);
+    return 2 * (int64_t)p - (int64_t)q;
+}
+
+// preamble_correlation(m + 1) - preamble_correlation(m): each chip gains the
+// sample following it and loses its first one, so only the chip edges matter
+static inline int64_t preamble_correlation_step(const uint16_t *m, unsigned h)
+{
+    return -2 * (int64_t)m[0] + 3 * (int64_t)m[h] - 3 * (int64_t)m[2 * h] + 3 * (int64_t)m[3 * h] -
+           3 * (int64_t)m[7 * h] + 3 * (int64_t)m[8 * h] - 3 * (int64_t)m[9 * h] + 3 * (int64_t)m[10 * h] -
+           (int64_t)m[12 * h];
+}
+
+// Slice up to 112 bits starting at the first data chip 'd'.
+// Returns the number of bytes decoded (1 for an unknown DF).
+static int slice_message(const uint16_t *d, unsigned h, unsigned char *msg)
+{
+    int bytelen = MODES_LONG_MSG_BYTES;
+    int i;
+
+    for (i = 0; i < bytelen; ++i)
+    {
+        uint8_t theByte = 0;
+
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            uint32_t first = chip_sum(d, h);
+            uint32_t second = chip_sum(d + h, h);
+            theByte = (theByte << 1) | (first > second ? 1 : 0);
+            d += 2 * h;
+        }
+
+        msg[i] = theByte;
+        if (i == 0)
+        {
+            switch (msg[0] >> 3)
+            {
+            case 0:
+            case 4:
+            case 5:
+            case 11:
+                bytelen = MODES_SHORT_MSG_BYTES;
+                break;
+
+            case 16:
+            case 17:
+            case 18:
+            case 20:
+            case 21:
+            case 24:
+                break;
+
+            default:
+                bytelen = 1; // unknown DF, give up immediately
+                break;
+            }
+        }
+    }
+
+    return i;
+}
+
+/* Given 'mlen' magnitude samples in 'm', sampled at lib_state.sample_rate
+ * (a multiple of 2MHz), try to demodulate some Mode S messages.
+ */
+void demodulate_hirate(struct mag_buf *mag)
+{
+    static modes_message_t zeroMessage;
+    modes_message_t mm;
+    unsigned char msg1[MODES_LONG_MSG_BYTES], msg2[MODES_LONG_MSG_BYTES], *msg;
+    uint32_t j;
+
+    unsigned char *bestmsg;
+    int bestscore, bestoffset;
+
+    // checksum results for msg1 / msg2
+    modes_score_t check1, check2, *check, *bestcheck;
+
+    // samples per chip, and 12MHz clock ticks per sample
+    const unsigned h = (unsigned)(lib_state.sample_rate / 2e6);
+    const double ticks_per_sample = 12e6 / lib_state.sample_rate;
+
+    // chip centres used by the quick check below
+    const unsigned c0 = h / 2, c1 = c0 + h, c2 = c1 + h, c3 = c2 + h;
+    const unsigned c4 = c3 + h, c5 = c4 + h, c6 = c5 + h, c7 = c6 + h, c8 = c7 + h, c9 = c8 + h;
+
+    // maximum lookahead we use: peak search, 16 preamble chips, 224 data chips, neighbour phase
+    assert(h >= 3);
+    assert(mag->overlap >= (16 + 224 + 2) * h + 2);
+
+    uint16_t *m = mag->data;
+    uint32_t mlen = mag->validLength - mag->overlap;
+
+    uint64_t sum_scaled_signal_power = 0;
+
+    uint64_t demod_start = ustime();
+    if (mag->readyTimestamp)
+        latency_hist_add(&lib_state.stats_current.latency_block_to_demod, demod_start - mag->readyTimestamp);
+
+    msg = msg1;
+    check = &check1;
+
+    for (j = 1; j < mlen; j++)
+    {
+        uint16_t *preamble = &m[j];
+        uint32_t pulse, quiet, quiet_max, high;
+        int64_t corr, best_corr, corr_prev, corr_next;
+        uint32_t peak, try_pos[2];
+        int ntry, msglen;
+        double frac;
+
+        // quick check on the chip centres: every pulse (0, 2, 7, 9) must stand
+        // above every quiet chip (1, 3, 4, 5, 6, 8)
+        if (!(preamble[c0] > preamble[c1] && preamble[c2] > preamble[c1]))
+            continue;
+
+        {
+            uint16_t pmin = preamble[c0], qmax = preamble[c1];
+            if (preamble[c2] < pmin)
+                pmin = preamble[c2];
+            if (preamble[c7] < pmin)
+                pmin = preamble[c7];
+            if (preamble[c9] < pmin)
+                pmin = preamble[c9];
+            if (preamble[c3] > qmax)
+                qmax = preamble[c3];
+            if (preamble[c4] > qmax)
+                qmax = preamble[c4];
+            if (preamble[c5] > qmax)
+                qmax = preamble[c5];
+            if (preamble[c6] > qmax)
+                qmax = preamble[c6];
+            if (preamble[c8] > qmax)
+                qmax = preamble[c8];
+            if (pmin <= qmax)
+                continue;
+        }
+
+        // find the correlation peak within the next chip
+        peak = j;
+        best_corr = corr = preamble_correlation(preamble, h);
+        for (unsigned k = 1; k <= h; ++k)
+        {
+            corr += preamble_correlation_step(preamble + k - 1, h);
+            if (corr > best_corr)
+            {
+                best_corr = corr;
+                peak = j + k;
+            }
+        }
+
+        // don't come back to this preamble on the next few samples
+        j = peak;
+
+        if (best_corr <= 0)
+            continue;
+
+        preamble_energy(&m[peak], h, &pulse, &quiet, &quiet_max);
+
+        // Check for enough signal: mean pulse chip at least 1.5x the mean quiet chip,
+        // about 3.5dB SNR
+        if (4 * pulse < 3 * quiet)
+            continue;
+
+        // Check that the quiet chips are actually quiet
+        high = pulse / 4;
+        if (quiet_max >= high)
+            continue;
+
+        // Sub-sample timing: parabolic interpolation around the peak
+        corr_prev = best_corr - preamble_correlation_step(&m[peak - 1], h);
+        corr_next = best_corr + preamble_correlation_step(&m[peak], h);
+        {
+            double denom = (double)corr_prev - 2.0 * best_corr + (double)corr_next;
+            frac = (denom < 0) ? 0.5 * (corr_prev - corr_next) / denom : 0.0;
+            if (frac > 0.5)
+                frac = 0.5;
+            else if (frac < -0.5)
+                frac = -0.5;
+        }
+
+        // try the peak, and the neighbouring sample on the side the true peak lies on
+        ntry = 0;
+        try_pos[ntry++] = peak;
+        if (frac > 0.1)
+            try_pos[ntry++] = peak + 1;
+        else if (frac < -0.1)
+            try_pos[ntry++] = peak - 1;
+
+        READSB_TRACE2(demod_preamble, mag->sampleTimestamp + (uint64_t)(peak * ticks_per_sample), high);
+
+        lib_state.stats_current.demod_preambles++;
+        bestmsg = NULL;
+        bestcheck = NULL;
+        bestscore = -2;
+        bestoffset = -1;
+        for (int t = 0; t < ntry; ++t)
+        {
+            int bytes = slice_message(&m[try_pos[t] + 16 * h], h, msg);
+
+            // Score the mode S message and see if it's any good.
+            // (the first try is always kept so a rejected candidate
+            // still has something to show for diagnostics)
+            int score = score_modes_message(msg, bytes * 8, check);
+            if (score > bestscore || !bestmsg)
+            {
+                // new high score!
+                bestmsg = msg;
+                bestcheck = check;
+                bestscore = score;
+                bestoffset = try_pos[t] - peak + 1;
+
+                // swap to using the other buffer so we don't clobber our demodulated data
+                msg = (msg == msg1) ? msg2 : msg1;
+                check = (check == &check1) ? &check2 : &check1;
+            }
+        }
+
+        // Do we have a candidate?
+        if (bestscore < 0)
+        {
+            if (bestscore == -1)
+                lib_state.stats_current.demod_rejected_unknown_icao++;
+            else
+                lib_state.stats_current.demod_rejected_bad++;
+            if (lib_state.config.demod_capture_size)
+                demod_capture_add(&m[peak], mag->sampleTimestamp + (uint64_t)(peak * ticks_per_sample), bestoffset, bestmsg, bestscore);
+            continue; // nope.
+        }
+
+        msglen = modes_message_len_by_type(bestmsg[0] >> 3);
+
+        // Set initial mm structure details
+        mm = zeroMessage;
+
+        // For consistency with how the Beast / Radarcape does it,
+        // we report the timestamp at the end of bit 56 (even if
+        // the frame is a 112-bit frame)
+        mm.timestampMsg = mag->sampleTimestamp + (uint64_t)llround((peak + frac) * ticks_per_sample) + (8 + 56) * 12;
+
+        // compute message receive time as block-start-time + difference in the 12MHz clock
+        mm.sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm.timestampMsg);
+
+        mm.score = bestscore;
+
+        // Decode the received message
+        {
+            int result = decode_modes_message(&mm, bestmsg, bestcheck);
+            if (result < 0)
+            {
+                if (result == -1)
+                    lib_state.stats_current.demod_rejected_unknown_icao++;
+                else
+                    lib_state.stats_current.demod_rejected_bad++;
+                if (lib_state.config.demod_capture_size)
+                    demod_capture_add(&m[peak], mag->sampleTimestamp + (uint64_t)(peak * ticks_per_sample), bestoffset, bestmsg, result);
+                continue;
+            }
+            else
+            {
+                lib_state.stats_current.demod_accepted[mm.correctedbits]++;
+                mm.decodedUs = ustime();
+                latency_hist_add(&lib_state.stats_current.latency_demod_to_decode, mm.decodedUs - demod_start);
+            }
+        }
+
+        // measure signal power
+        {
+            double signal_power;
+            uint64_t scaled_signal_power = 0;
+            int signal_len = msglen * 2 * h;
+            int k;
+
+            for (k = 0; k < signal_len; ++k)
+            {
+                uint32_t mag = m[peak + 16 * h + k];
+                scaled_signal_power += mag * mag;
+            }
+
+            signal_power = scaled_signal_power / 65535.0 / 65535.0;
+            mm.signalLevel = signal_power / signal_len;
+            lib_state.stats_current.signal_power_sum += signal_power;
+            lib_state.stats_current.signal_power_count += signal_len;
+            sum_scaled_signal_power += scaled_signal_power;
+
+            if (mm.signalLevel > lib_state.stats_current.peak_signal_power)
+                lib_state.stats_current.peak_signal_power = mm.signalLevel;
+            if (mm.signalLevel > 0.50119)
+                lib_state.stats_current.strong_signal_count++; // signal power above -3dBFS
+        }
+
+        // Skip over the message, leaving the last 8us for a following preamble
+        // (same as the 2.4MHz demodulator)
+        j = peak + msglen * 2 * h;
+
+        // Pass data to the next layer
+        READSB_TRACE3(demod_accept, mm.timestampMsg, mm.score, mm.addr);
+        use_modes_message(&mm);
+    }
+
+    /* update noise power */
+    {
+        double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
+        lib_state.stats_current.noise_power_sum += (mag->mean_power * mlen - sum_signal_power);
+        lib_state.stats_current.noise_power_count += mlen;
+    }
+
+    if (lib_state.config.maintenance_budget)
+        track_maintenance_step();
+    latency_hist_add(&lib_state.stats_current.latency_block, ustime() - demod_start);
+}
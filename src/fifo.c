@@ -1,5 +1,6 @@
 #include "fifo.h"
 #include "util.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -189,6 +190,9 @@ void fifo_enqueue(struct mag_buf *buf)
     // Save the tail of the buffer for next time
     memcpy(overlap_buffer, &buf->data[buf->validLength - overlap_length], overlap_length * sizeof(overlap_buffer[0]));
 
+    buf->readyTimestamp = ustime();
+    READSB_TRACE2(fifo_enqueue, buf->sampleTimestamp, buf->validLength);
+
     // enqueue and tell the main thread
     buf->next = NULL;
     if (!fifo_head)
@@ -239,6 +243,7 @@ struct mag_buf *fifo_dequeue(uint32_t timeout_ms)
         result = fifo_head;
         fifo_head = result->next;
         result->next = NULL;
+        READSB_TRACE2(fifo_dequeue, result->sampleTimestamp, result->validLength);
         if (!fifo_head)
         {
             fifo_tail = NULL;
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "geomag.h"
 
 #define NaN log(-1.0)
@@ -129,9 +131,72 @@ const struct
 #define B4 (double)(B2 * B2)
 #define C4 (double)(A4 - B4)
 
-static double c[13][13], cd[13][13], tc[13][13], dp[13][13], snorm[169];
-static double sp[13], cp[13], fn[13], fm[13], pp[13], k[13][13];
-static double *p = snorm;
+/**
+ * Unnormalized Gauss coefficients and recursion constants.
+ * Written once by geomag_init and only read afterwards.
+ */
+static struct
+{
+    double c[13][13];
+    double cd[13][13];
+    double k[13][13];
+    double fn[13];
+    double fm[13];
+} model;
+
+/**
+ * Per-call working state, kept on the caller's stack so any number of
+ * threads can evaluate the model at once.
+ */
+struct geomag_workspace
+{
+    double tc[13][13]; // Gauss coefficients adjusted to the requested date
+    double p[13][13];  // Legendre polynomials, [m][n]
+    double dp[13][13]; // and their derivatives
+    double pp[13];     // Legendre terms at the geographic poles
+    double sp[13];     // sin(m * lon)
+    double cp[13];     // cos(m * lon)
+    double st, ct;     // sine and cosine of the spherical colatitude
+    double aor;        // mean radius over geocentric radius
+    double ca, sa;     // rotation from spherical to geodetic
+};
+
+/**
+ * Declination cache.
+ * Nodes sit every GEOMAG_CACHE_STEP degrees of latitude and longitude in
+ * altitude bands of GEOMAG_CACHE_ALT_STEP km, and are grouped in tiles of
+ * GEOMAG_CACHE_TILE x GEOMAG_CACHE_TILE nodes over all bands. Tiles are
+ * allocated when first touched and a band of a tile is evaluated in one
+ * batch on first use, so only the area around the receiver is ever
+ * computed. Positions beyond GEOMAG_CACHE_MAX_LAT, and cells whose corners
+ * differ by more than GEOMAG_CACHE_MAX_SPREAD (close to the magnetic poles
+ * declination turns too fast to interpolate), are always evaluated directly.
+ *
+ * Each node holds the float declination in its low 32 bits and the day it
+ * was evaluated for in the high 32 bits, so nodes from another day simply
+ * read as missing. Tiles are published with a CAS and only freed by
+ * geomag_destroy, so lookups take no locks.
+ */
+#define GEOMAG_CACHE_STEP 0.5
+#define GEOMAG_CACHE_ALT_STEP 2.0
+#define GEOMAG_CACHE_ALT_BANDS 10
+#define GEOMAG_CACHE_MAX_LAT 80.0
+#define GEOMAG_CACHE_MAX_SPREAD 1.0 // degrees between cell corners
+#define GEOMAG_CACHE_TILE 8
+#define GEOMAG_CACHE_LAT_NODES 361 // -90 .. 90
+#define GEOMAG_CACHE_LON_NODES 720 // -180 .. 179.5, wrapping
+#define GEOMAG_CACHE_LAT_TILES ((GEOMAG_CACHE_LAT_NODES + GEOMAG_CACHE_TILE - 1) / GEOMAG_CACHE_TILE)
+#define GEOMAG_CACHE_LON_TILES (GEOMAG_CACHE_LON_NODES / GEOMAG_CACHE_TILE)
+
+struct geomag_tile
+{
+    _Atomic uint64_t dec[GEOMAG_CACHE_ALT_BANDS][GEOMAG_CACHE_TILE][GEOMAG_CACHE_TILE];
+};
+
+static _Atomic(struct geomag_tile *) geomag_tiles[GEOMAG_CACHE_LAT_TILES][GEOMAG_CACHE_LON_TILES];
+
+// Day of the year in bits 0-8, time to look at the clock again above
+static _Atomic uint64_t geomag_clock_state;
 
 /**
  * Initialize library.
@@ -142,13 +207,10 @@ int geomag_init()
     /* Initialize geomag routine */
     int m, n, j, D1, D2;
     double flnmj;
-    sp[0] = 0.0;
-    cp[0] = *p = pp[0] = 1.0;
-    dp[0][0] = 0.0;
+    double snorm[169];
 
     /* Read world magnetic model spherical harmonic coefficients */
-    c[0][0] = 0.0;
-    cd[0][0] = 0.0;
+    memset(&model, 0, sizeof(model));
 
     for (int i = 0; i < 90; i++)
     {
@@ -162,81 +224,115 @@ int geomag_init()
 
         if (wmm_obj[i].m <= wmm_obj[i].n)
         {
-            c[wmm_obj[i].m][wmm_obj[i].n] = wmm_obj[i].gnm;
-            cd[wmm_obj[i].m][wmm_obj[i].n] = wmm_obj[i].dgnm;
+            model.c[wmm_obj[i].m][wmm_obj[i].n] = wmm_obj[i].gnm;
+            model.cd[wmm_obj[i].m][wmm_obj[i].n] = wmm_obj[i].dgnm;
             if (wmm_obj[i].m != 0)
             {
-                c[wmm_obj[i].n][wmm_obj[i].m - 1] = wmm_obj[i].hnm;
-                cd[wmm_obj[i].n][wmm_obj[i].m - 1] = wmm_obj[i].dhnm;
+                model.c[wmm_obj[i].n][wmm_obj[i].m - 1] = wmm_obj[i].hnm;
+                model.cd[wmm_obj[i].n][wmm_obj[i].m - 1] = wmm_obj[i].dhnm;
             }
         }
     }
 
     /* Convert Schmidt normalized Gauss coefficients to unnormalized */
     *snorm = 1.0;
-    fm[0] = 0.0;
+    model.fm[0] = 0.0;
     for (n = 1; n <= MAXDEG; n++)
     {
         *(snorm + n) = *(snorm + n - 1) * (double)(2 * n - 1) / (double)n;
         j = 2;
         for (m = 0, D1 = 1, D2 = (n - m + D1) / D1; D2 > 0; D2--, m += D1)
         {
-            k[m][n] = (double)(((n - 1) * (n - 1)) - (m * m)) / (double)((2 * n - 1) * (2 * n - 3));
+            model.k[m][n] = (double)(((n - 1) * (n - 1)) - (m * m)) / (double)((2 * n - 1) * (2 * n - 3));
             if (m > 0)
             {
                 flnmj = (double)((n - m + 1) * j) / (double)(n + m);
                 *(snorm + n + m * 13) = *(snorm + n + (m - 1) * 13) * sqrt(flnmj);
                 j = 1;
-                c[n][m - 1] = *(snorm + n + m * 13) * c[n][m - 1];
-                cd[n][m - 1] = *(snorm + n + m * 13) * cd[n][m - 1];
+                model.c[n][m - 1] = *(snorm + n + m * 13) * model.c[n][m - 1];
+                model.cd[n][m - 1] = *(snorm + n + m * 13) * model.cd[n][m - 1];
             }
-            c[m][n] = *(snorm + n + m * 13) * c[m][n];
-            cd[m][n] = *(snorm + n + m * 13) * cd[m][n];
+            model.c[m][n] = *(snorm + n + m * 13) * model.c[m][n];
+            model.cd[m][n] = *(snorm + n + m * 13) * model.cd[m][n];
         }
-        fn[n] = (double)(n + 1);
-        fm[n] = (double)n;
+        model.fn[n] = (double)(n + 1);
+        model.fm[n] = (double)n;
     }
-    k[1][1] = 0.0;
+    model.k[1][1] = 0.0;
 
     return 0;
 }
 
 /**
- * Calculate geo magnetic paramters for given position and altitude.
- * @param alt Altitude above WGS84 ellipsoid in km
- * @param lat Latitude in decimal degrees
- * @param lon Longitude in decimal degrees
- * @param time Decimal year
- * @param dec https://en.wikipedia.org/wiki/Magnetic_declination
- * @param dip https://en.wikipedia.org/wiki/Magnetic_dip
- * @param ti Total intensity in nano Tesla nT
- * @param gv Grid variation
- * @return 0 on SUCCESS, 1 on ERROR
+ * Free the declination cache. Not to be called while other threads
+ * use the library.
  */
-int geomag_calc(double alt, double lat, double lon, double decimal_year, double *dec, double *dip, double *ti, double *gv)
+void geomag_destroy()
 {
-    time_t rawtime;
-    struct tm *info;
-    // Calculate decimal year when not provided.
-    if (decimal_year < 0.0)
+    for (int i = 0; i < GEOMAG_CACHE_LAT_TILES; i++)
     {
-        time(&rawtime);
-        info = gmtime(&rawtime);
-        decimal_year = epoch + ((double)info->tm_yday / 365.0);
+        for (int j = 0; j < GEOMAG_CACHE_LON_TILES; j++)
+            free(atomic_exchange(&geomag_tiles[i][j], NULL));
     }
+    atomic_store(&geomag_clock_state, 0);
+}
+
+/**
+ * Day of the year the model is evaluated for when no date is given. It
+ * changes once a day, so the clock is read at most once a minute and the
+ * calendar worked out only then.
+ * @return Day of the year, 0 = January 1st
+ */
+static unsigned geomag_day()
+{
+    uint64_t state = atomic_load_explicit(&geomag_clock_state, memory_order_relaxed);
+    time_t rawtime;
+    struct tm info;
+
+    time(&rawtime);
+    if ((uint64_t)rawtime < (state >> 9))
+        return state & 0x1ff;
+
+    gmtime_r(&rawtime, &info);
+    state = ((uint64_t)(rawtime + 60) << 9) | (unsigned)info.tm_yday;
+    atomic_store_explicit(&geomag_clock_state, state, memory_order_relaxed);
+    return info.tm_yday;
+}
 
+/**
+ * Decimal year used when none is given.
+ * @return Decimal year
+ */
+double geomag_decimal_year()
+{
+    return epoch + ((double)geomag_day() / 365.0);
+}
+
+/* Time adjust the gauss coefficients */
+static void geomag_set_date(struct geomag_workspace *ws, double decimal_year)
+{
     double dt = decimal_year - epoch;
+
+    for (int n = 1; n <= MAXDEG; n++)
+    {
+        for (int m = 0; m <= n; m++)
+        {
+            ws->tc[m][n] = model.c[m][n] + dt * model.cd[m][n];
+            if (m != 0)
+                ws->tc[n][m - 1] = model.c[n][m - 1] + dt * model.cd[n][m - 1];
+        }
+    }
+}
+
+/* Terms that only depend on altitude and latitude */
+static void geomag_set_latitude(struct geomag_workspace *ws, double alt, double lat)
+{
     double dtr = M_PI / 180.0;
-    double rlon = lon * dtr;
     double rlat = lat * dtr;
-    double srlon = sin(rlon);
     double srlat = sin(rlat);
-    double crlon = cos(rlon);
     double crlat = cos(rlat);
     double srlat2 = srlat * srlat;
     double crlat2 = crlat * crlat;
-    sp[1] = srlon;
-    cp[1] = crlon;
 
     /* Convert from geodetic coordinates to spherical coordinates. */
     double q = sqrt(A2 - C2 * srlat2);
@@ -247,18 +343,76 @@ int geomag_calc(double alt, double lat, double lon, double decimal_year, double
     double r2 = (alt * alt) + 2.0 * q1 + (A4 - C4 * srlat2) / (q * q);
     double r = sqrt(r2);
     double d = sqrt(A2 * crlat2 + B2 * srlat2);
-    double ca = (alt + d) / r;
-    double sa = C2 * crlat * srlat / (r * d);
+    ws->ca = (alt + d) / r;
+    ws->sa = C2 * crlat * srlat / (r * d);
+    ws->aor = RE / r;
+    ws->st = st;
+    ws->ct = ct;
+
+    int n, m, D3, D4;
+
+    ws->p[0][0] = ws->pp[0] = 1.0;
+    ws->dp[0][0] = 0.0;
+    for (n = 1; n <= MAXDEG; n++)
+    {
+        for (m = 0, D3 = 1, D4 = (n + m + D3) / D3; D4 > 0; D4--, m += D3)
+        {
+            /* Compute unnormalized associated legendre polynomials
+             * and derivatives via recursion relations.               
+             */
+            if (n == m)
+            {
+                ws->p[m][n] = st * ws->p[m - 1][n - 1];
+                ws->dp[m][n] = st * ws->dp[m - 1][n - 1] + ct * ws->p[m - 1][n - 1];
+            }
+            else if (n == 1 && m == 0)
+            {
+                ws->p[m][n] = ct * ws->p[m][n - 1];
+                ws->dp[m][n] = ct * ws->dp[m][n - 1] - st * ws->p[m][n - 1];
+            }
+            else if (n > 1 && n != m)
+            {
+                if (m > n - 2)
+                    ws->p[m][n - 2] = 0.0;
+                if (m > n - 2)
+                    ws->dp[m][n - 2] = 0.0;
+                ws->p[m][n] = ct * ws->p[m][n - 1] - model.k[m][n] * ws->p[m][n - 2];
+                ws->dp[m][n] = ct * ws->dp[m][n - 1] - st * ws->p[m][n - 1] - model.k[m][n] * ws->dp[m][n - 2];
+            }
+        }
+        /* Special case: north/south geographic poles */
+        if (st == 0.0)
+        {
+            if (n == 1)
+                ws->pp[n] = ws->pp[n - 1];
+            else
+                ws->pp[n] = ct * ws->pp[n - 1] - model.k[1][n] * ws->pp[n - 2];
+        }
+    }
+}
 
+/* Accumulate the spherical harmonic expansions at a longitude and
+ * return the field in geodetic coordinates.
+ */
+static void geomag_field(struct geomag_workspace *ws, double lon, double *bx, double *by, double *bz)
+{
+    double dtr = M_PI / 180.0;
+    double rlon = lon * dtr;
+    double *sp = ws->sp;
+    double *cp = ws->cp;
     int n, m, D3, D4;
 
+    sp[0] = 0.0;
+    cp[0] = 1.0;
+    sp[1] = sin(rlon);
+    cp[1] = cos(rlon);
     for (m = 2; m <= MAXDEG; m++)
     {
         sp[m] = sp[1] * cp[m - 1] + cp[1] * sp[m - 1];
         cp[m] = cp[1] * cp[m - 1] - sp[1] * sp[m - 1];
     }
 
-    double aor = RE / r;
+    double aor = ws->aor;
     double ar = aor * aor;
     double br = 0.0;
     double bt = 0.0;
@@ -271,76 +425,71 @@ int geomag_calc(double alt, double lat, double lon, double decimal_year, double
         ar = ar * aor;
         for (m = 0, D3 = 1, D4 = (n + m + D3) / D3; D4 > 0; D4--, m += D3)
         {
-            /* Compute unnormalized associated legendre polynomials
-             * and derivatives via recursion relations.               
-             */
-            if (n == m)
-            {
-                *(p + n + m * 13) = st * *(p + n - 1 + (m - 1) * 13);
-                dp[m][n] = st * dp[m - 1][n - 1] + ct * *(p + n - 1 + (m - 1) * 13);
-                goto S50;
-            }
-            if (n == 1 && m == 0)
-            {
-                *(p + n + m * 13) = ct * *(p + n - 1 + m * 13);
-                dp[m][n] = ct * dp[m][n - 1] - st * *(p + n - 1 + m * 13);
-                goto S50;
-            }
-            if (n > 1 && n != m)
-            {
-                if (m > n - 2)
-                    *(p + n - 2 + m * 13) = 0.0;
-                if (m > n - 2)
-                    dp[m][n - 2] = 0.0;
-                *(p + n + m * 13) = ct * *(p + n - 1 + m * 13) - k[m][n] * *(p + n - 2 + m * 13);
-                dp[m][n] = ct * dp[m][n - 1] - st * *(p + n - 1 + m * 13) - k[m][n] * dp[m][n - 2];
-            }
-        S50:
-            /* Time adjust the gauss coefficients */
-            tc[m][n] = c[m][n] + dt * cd[m][n];
-            if (m != 0)
-                tc[n][m - 1] = c[n][m - 1] + dt * cd[n][m - 1];
-            /* Accumulate terms of the spherical harmonic expansions */
-            par = ar * *(p + n + m * 13);
+            par = ar * ws->p[m][n];
             if (m == 0)
             {
-                temp1 = tc[m][n] * cp[m];
-                temp2 = tc[m][n] * sp[m];
+                temp1 = ws->tc[m][n] * cp[m];
+                temp2 = ws->tc[m][n] * sp[m];
             }
             else
             {
-                temp1 = tc[m][n] * cp[m] + tc[n][m - 1] * sp[m];
-                temp2 = tc[m][n] * sp[m] - tc[n][m - 1] * cp[m];
+                temp1 = ws->tc[m][n] * cp[m] + ws->tc[n][m - 1] * sp[m];
+                temp2 = ws->tc[m][n] * sp[m] - ws->tc[n][m - 1] * cp[m];
             }
-            bt = bt - ar * temp1 * dp[m][n];
-            bp += (fm[m] * temp2 * par);
-            br += (fn[n] * temp1 * par);
+            bt = bt - ar * temp1 * ws->dp[m][n];
+            bp += (model.fm[m] * temp2 * par);
+            br += (model.fn[n] * temp1 * par);
             /* Special case: north/south geographic poles */
-            if (st == 0.0 && m == 1)
+            if (ws->st == 0.0 && m == 1)
             {
-                if (n == 1)
-                    pp[n] = pp[n - 1];
-                else
-                    pp[n] = ct * pp[n - 1] - k[m][n] * pp[n - 2];
-                parp = ar * pp[n];
-                bpp += (fm[m] * temp2 * parp);
+                parp = ar * ws->pp[n];
+                bpp += (model.fm[m] * temp2 * parp);
             }
         }
     }
 
-    if (st == 0.0)
+    if (ws->st == 0.0)
         bp = bpp;
     else
-        bp /= st;
+        bp /= ws->st;
     /* Rotate magnetic vector components from spherical to
      * geodetic coordinates.
      */
-    double bx = -bt * ca - br * sa;
-    double by = bp;
-    double bz = bt * sa - br * ca;
+    *bx = -bt * ws->ca - br * ws->sa;
+    *by = bp;
+    *bz = bt * ws->sa - br * ws->ca;
+}
+
+/**
+ * Calculate geo magnetic paramters for given position and altitude.
+ * Threadsafe once geomag_init has returned.
+ * @param alt Altitude above WGS84 ellipsoid in km
+ * @param lat Latitude in decimal degrees
+ * @param lon Longitude in decimal degrees
+ * @param time Decimal year
+ * @param dec https://en.wikipedia.org/wiki/Magnetic_declination
+ * @param dip https://en.wikipedia.org/wiki/Magnetic_dip
+ * @param ti Total intensity in nano Tesla nT
+ * @param gv Grid variation
+ * @return 0 on SUCCESS, 1 on ERROR
+ */
+int geomag_calc(double alt, double lat, double lon, double decimal_year, double *dec, double *dip, double *ti, double *gv)
+{
+    struct geomag_workspace ws;
+    double bx, by, bz;
+
+    // Calculate decimal year when not provided.
+    if (decimal_year < 0.0)
+        decimal_year = geomag_decimal_year();
+
+    geomag_set_date(&ws, decimal_year);
+    geomag_set_latitude(&ws, alt, lat);
+    geomag_field(&ws, lon, &bx, &by, &bz);
+
     /* Compute declination (dec), inclination (dip) and
      * total intensity (ti).
      */
+    double dtr = M_PI / 180.0;
     double bh = sqrt((bx * bx) + (by * by));
     *ti = sqrt((bh * bh) + (bz * bz));
     *dec = atan2(by, bx) / dtr;
@@ -368,3 +517,173 @@ int geomag_calc(double alt, double lat, double lon, double decimal_year, double
     }
     return 0;
 }
+
+/**
+ * Calculate magnetic declination for many positions at one date.
+ * Coefficients are time adjusted once, and the latitude terms are only
+ * recomputed when altitude or latitude differ from the previous position,
+ * so positions sorted by latitude are cheapest.
+ * Threadsafe once geomag_init has returned.
+ * @param count Number of positions
+ * @param alt Altitudes above WGS84 ellipsoid in km
+ * @param lat Latitudes in decimal degrees
+ * @param lon Longitudes in decimal degrees
+ * @param decimal_year Decimal year, or negative for today
+ * @param dec Declinations in degrees, written for every position
+ * @return 0 on SUCCESS, 1 on ERROR
+ */
+int geomag_calc_declinations(unsigned count, const double *alt, const double *lat, const double *lon, double decimal_year, double *dec)
+{
+    struct geomag_workspace ws;
+    double bx, by, bz;
+    double dtr = M_PI / 180.0;
+
+    if (decimal_year < 0.0)
+        decimal_year = geomag_decimal_year();
+
+    geomag_set_date(&ws, decimal_year);
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (i == 0 || alt[i] != alt[i - 1] || lat[i] != lat[i - 1])
+            geomag_set_latitude(&ws, alt[i], lat[i]);
+        geomag_field(&ws, lon[i], &bx, &by, &bz);
+        dec[i] = atan2(by, bx) / dtr;
+    }
+    return 0;
+}
+
+/* Evaluate one altitude band of a tile for the given day. */
+static void geomag_fill(struct geomag_tile *t, int band, int tile_lat, int tile_lon, unsigned day)
+{
+    double alt[GEOMAG_CACHE_TILE * GEOMAG_CACHE_TILE];
+    double lat[GEOMAG_CACHE_TILE * GEOMAG_CACHE_TILE];
+    double lon[GEOMAG_CACHE_TILE * GEOMAG_CACHE_TILE];
+    double dec[GEOMAG_CACHE_TILE * GEOMAG_CACHE_TILE];
+
+    // The last row of tiles runs past the pole
+    int rows = GEOMAG_CACHE_LAT_NODES - tile_lat * GEOMAG_CACHE_TILE;
+    if (rows > GEOMAG_CACHE_TILE)
+        rows = GEOMAG_CACHE_TILE;
+    unsigned count = rows * GEOMAG_CACHE_TILE;
+
+    for (int i = 0; i < rows; i++)
+    {
+        int ilat = tile_lat * GEOMAG_CACHE_TILE + i;
+        for (int j = 0; j < GEOMAG_CACHE_TILE; j++)
+        {
+            alt[i * GEOMAG_CACHE_TILE + j] = band * GEOMAG_CACHE_ALT_STEP;
+            lat[i * GEOMAG_CACHE_TILE + j] = ilat * GEOMAG_CACHE_STEP - 90.0;
+            lon[i * GEOMAG_CACHE_TILE + j] = (tile_lon * GEOMAG_CACHE_TILE + j) * GEOMAG_CACHE_STEP - 180.0;
+        }
+    }
+
+    geomag_calc_declinations(count, alt, lat, lon, epoch + ((double)day / 365.0), dec);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        float f = (float)dec[i];
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        atomic_store_explicit(&t->dec[band][i / GEOMAG_CACHE_TILE][i % GEOMAG_CACHE_TILE],
+                              ((uint64_t)(day + 1) << 32) | bits, memory_order_relaxed);
+    }
+}
+
+/**
+ * Cached declination at a grid node.
+ * @return Declination in degrees, or NaN when out of memory
+ */
+static double geomag_node(int band, int ilat, int ilon, unsigned day)
+{
+    _Atomic(struct geomag_tile *) *slot;
+    struct geomag_tile *t, *expected = NULL;
+    uint64_t node;
+    uint32_t bits;
+    float f;
+
+    ilon = (ilon + GEOMAG_CACHE_LON_NODES) % GEOMAG_CACHE_LON_NODES;
+    slot = &geomag_tiles[ilat / GEOMAG_CACHE_TILE][ilon / GEOMAG_CACHE_TILE];
+    if (!(t = atomic_load_explicit(slot, memory_order_acquire)))
+    {
+        if (!(t = calloc(1, sizeof(*t))))
+            return NaN;
+        if (!atomic_compare_exchange_strong_explicit(slot, &expected, t, memory_order_acq_rel, memory_order_acquire))
+        {
+            // Another thread got there first
+            free(t);
+            t = expected;
+        }
+    }
+
+    _Atomic uint64_t *cell = &t->dec[band][ilat % GEOMAG_CACHE_TILE][ilon % GEOMAG_CACHE_TILE];
+    node = atomic_load_explicit(cell, memory_order_relaxed);
+    if ((node >> 32) != day + 1)
+    {
+        geomag_fill(t, band, ilat / GEOMAG_CACHE_TILE, ilon / GEOMAG_CACHE_TILE, day);
+        node = atomic_load_explicit(cell, memory_order_relaxed);
+    }
+
+    bits = (uint32_t)node;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/**
+ * Magnetic declination for the current date, interpolated from a lazily
+ * filled grid. Accurate to a few hundredths of a degree. Threadsafe.
+ * @param alt Altitude above WGS84 ellipsoid in km
+ * @param lat Latitude in decimal degrees
+ * @param lon Longitude in decimal degrees
+ * @param dec https://en.wikipedia.org/wiki/Magnetic_declination
+ * @return 0 on SUCCESS, 1 on ERROR
+ */
+int geomag_declination(double alt, double lat, double lon, double *dec)
+{
+    double dip, ti, gv;
+    unsigned day = geomag_day();
+    double year = epoch + ((double)day / 365.0);
+
+    // Only finite positions may be turned into grid indices
+    if (!isfinite(alt) || !isfinite(lat) || !isfinite(lon) ||
+        fabs(lat) > GEOMAG_CACHE_MAX_LAT || fabs(lon) > 180.0)
+        return geomag_calc(alt, lat, lon, year, dec, &dip, &ti, &gv);
+
+    // Nearest band, clamped before converting so any altitude is safe
+    double nearest = alt / GEOMAG_CACHE_ALT_STEP + 0.5;
+    int band;
+    if (nearest < 1.0)
+        band = 0;
+    else if (nearest >= GEOMAG_CACHE_ALT_BANDS)
+        band = GEOMAG_CACHE_ALT_BANDS - 1;
+    else
+        band = (int)nearest;
+
+    double y = (lat + 90.0) / GEOMAG_CACHE_STEP;
+    double x = (lon + 180.0) / GEOMAG_CACHE_STEP;
+    int ilat = (int)y;
+    int ilon = (int)x;
+    double fy = y - ilat;
+    double fx = x - ilon;
+
+    double d00 = geomag_node(band, ilat, ilon, day);
+    double d01 = geomag_node(band, ilat, ilon + 1, day);
+    double d10 = geomag_node(band, ilat + 1, ilon, day);
+    double d11 = geomag_node(band, ilat + 1, ilon + 1, day);
+    if (isnan(d00) || isnan(d01) || isnan(d10) || isnan(d11))
+        return geomag_calc(alt, lat, lon, year, dec, &dip, &ti, &gv);
+
+    // Keep the corners on the same side of +-180 as the first one.
+    d01 += (d01 - d00 > 180.0) ? -360.0 : (d00 - d01 > 180.0) ? 360.0 : 0.0;
+    d10 += (d10 - d00 > 180.0) ? -360.0 : (d00 - d10 > 180.0) ? 360.0 : 0.0;
+    d11 += (d11 - d00 > 180.0) ? -360.0 : (d00 - d11 > 180.0) ? 360.0 : 0.0;
+    if (fmax(fmax(d00, d01), fmax(d10, d11)) - fmin(fmin(d00, d01), fmin(d10, d11)) > GEOMAG_CACHE_MAX_SPREAD)
+        return geomag_calc(alt, lat, lon, year, dec, &dip, &ti, &gv);
+
+    double d = (d00 * (1.0 - fx) + d01 * fx) * (1.0 - fy) + (d10 * (1.0 - fx) + d11 * fx) * fy;
+    if (d > 180.0)
+        d -= 360.0;
+    if (d <= -180.0)
+        d += 360.0;
+    *dec = d;
+    return 0;
+}
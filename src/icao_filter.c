@@ -1,139 +1,566 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "util.h"
 #include "icao_filter.h"
 
-// hash table size, must be a power of two:
-#define ICAO_FILTER_SIZE 4096
+// Initial number of buckets per table, must be a power of two:
+#define ICAO_FILTER_BUCKETS 256
+
+// Entries per bucket: 16 x 32 bits fill one 64-byte cache line
+#define ICAO_FILTER_BUCKET_SIZE 16
+
+// Longest displacement path tried before growing a table
+#define ICAO_FILTER_MAX_PATH 32
 
 // Millis between filter expiry flips:
 #define MODES_ICAO_FILTER_TTL 60000
 
-// Open-addressed hash table with linear probing.
-// We store each address twice to handle Data/Parity
-// which need to match on a partial address (top 16 bits only).
+// Bucketized cuckoo hash tables: every key lives in one of two buckets, and
+// a bucket is one cache line, so a lookup touches at most two lines.
+// When no displacement path can be found for a new key the table doubles.
+//
+// Each entry packs an address with the generation it was last seen in:
+// (addr << 8) | stamp. Stamps are never 0, so an all-zero entry is free.
+// Entries stamped with the current or the previous generation match;
+// icao_filter_expire() starts a new generation, which ages out everything
+// not seen since the one before - the same as flipping between two tables.
+//
+// We keep two tables: one keyed on the full address, and one keyed on the
+// low 16 bits to handle Data/Parity, which needs to match on a partial address.
+//
+// Concurrency:
+//
+//  - Tests take no locks. They load the table pointer and the generations
+//    once, then read entries.
+//  - Adds that refresh an entry or fill a free slot do so with a CAS.
+//    Two threads adding the same new address at once may both insert it;
+//    the duplicate is harmless and ages out.
+//  - Displacement, growth and expiry are serialized by icao_filter_mutex.
+//    Displacement moves entries with CAS, copying each entry to its new
+//    slot before overwriting the old one, and gives up if any slot changed
+//    under it. icao_filter_moves is odd while entries are moving, so a test
+//    that missed during a move retries.
+//  - Growth copies into a new table and publishes it through the table
+//    pointer. icao_filter_resizing is set during the copy; an add that
+//    raced with it redoes its work under the mutex. Replaced tables are
+//    freed two generations later, long after any test could still be
+//    reading them.
+//
+// The full-address table also keeps, next to each entry, the tracked
+// aircraft for that address (see icao_filter_set_aircraft), so scoring can
+// hand the tracker its record without a second lookup. Handles are only set
+// under the mutex (lock-free adds just clear them) and only ever sit in the
+// buckets of their own address, so clearing those when the aircraft goes
+// leaves no dangling handle. A handle may still belong to a different
+// address while entries move, so the tracker checks it.
+
+struct icao_table
+{
+    _Atomic uint32_t *entries;            // nbuckets * ICAO_FILTER_BUCKET_SIZE, cache line aligned
+    _Atomic(struct aircraft *) *aircraft; // per-entry aircraft handles, or NULL if this table has none
+    uint32_t mask;                        // nbuckets - 1
+    uint32_t key_mask;                    // bits of an entry that form the key
+    struct icao_table *retired_next;      // next table waiting to be freed
+    unsigned retired_flips;               // expiry flips seen since it was replaced
+};
+
+static _Atomic(struct icao_table *) icao_filter_full;
+static _Atomic(struct icao_table *) icao_filter_partial;
 
-// Maintain two tables and switch between them to age out entries.
+// Stamp for entries added now in bits 0-7; the previous generation,
+// which still matches, in bits 8-15
+static atomic_uint icao_filter_gens;
 
-static uint32_t icao_filter_a[ICAO_FILTER_SIZE];
-static uint32_t icao_filter_b[ICAO_FILTER_SIZE];
-static uint32_t *icao_filter_active;
+static pthread_mutex_t icao_filter_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes displacement, growth and expiry
+static atomic_uint icao_filter_moves;                                 // odd while a displacement is moving entries
+static atomic_int icao_filter_resizing;                               // set while a table is being copied
+static struct icao_table *icao_filter_retired;                        // replaced tables, not yet freed
+static uint32_t icao_filter_rand = 2463534242U;                       // xorshift state for picking victims, under the mutex
 
-static uint32_t icao_hash(uint32_t a)
+static inline uint32_t icao_hash(uint32_t key)
 {
-    // Jenkins one-at-a-time hash, unrolled for 3 bytes
-    uint32_t hash = 0;
+    // murmur3 finalizer
+    uint32_t h = key;
 
-    hash += a & 0xff;
-    hash += hash << 10;
-    hash ^= hash >> 6;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
 
-    hash += (a >> 8) & 0xff;
-    hash += (hash << 10);
-    hash ^= (hash >> 6);
+    return h;
+}
 
-    hash += (a >> 16) & 0xff;
-    hash += (hash << 10);
-    hash ^= (hash >> 6);
+// The two buckets come from the two halves of one hash
+static inline uint32_t icao_bucket1(const struct icao_table *t, uint32_t entry)
+{
+    return icao_hash((entry & t->key_mask) >> 8) & t->mask;
+}
 
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
+static inline uint32_t icao_bucket2(const struct icao_table *t, uint32_t entry)
+{
+    uint32_t h = icao_hash((entry & t->key_mask) >> 8);
+    return ((h >> 16) | (h << 16)) & t->mask;
+}
 
-    return hash & (ICAO_FILTER_SIZE - 1);
+static inline _Atomic uint32_t *icao_bucket(const struct icao_table *t, uint32_t b)
+{
+    return &t->entries[b * ICAO_FILTER_BUCKET_SIZE];
 }
 
-void icao_filter_init()
+static inline int icao_stamp_live(uint32_t entry, uint32_t gens)
 {
-    memset(icao_filter_a, 0, sizeof(icao_filter_a));
-    memset(icao_filter_b, 0, sizeof(icao_filter_b));
-    icao_filter_active = icao_filter_a;
+    uint32_t stamp = entry & 0xff;
+    return stamp && (stamp == (gens & 0xff) || stamp == ((gens >> 8) & 0xff));
 }
 
-void icao_filter_add(uint32_t addr)
+// Bitmask of the entries in a bucket whose key bits equal 'want'.
+// Entries are only used as a hint: callers load the slot again before
+// trusting it.
+static inline unsigned icao_bucket_match(_Atomic uint32_t *bucket, uint32_t want, uint32_t key_mask)
+{
+#if defined(__SSE2__)
+    // aligned vector loads read each 32-bit lane atomically
+    const __m128i *v = (const __m128i *)bucket;
+    __m128i w = _mm_set1_epi32((int)want);
+    __m128i m = _mm_set1_epi32((int)key_mask);
+    unsigned bits = 0;
+
+    for (int i = 0; i < ICAO_FILTER_BUCKET_SIZE / 4; ++i)
+    {
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(_mm_load_si128(&v[i]), m), w);
+        bits |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(eq)) << (4 * i);
+    }
+
+    return bits;
+#else
+    unsigned bits = 0;
+
+    for (int i = 0; i < ICAO_FILTER_BUCKET_SIZE; ++i)
+    {
+        if ((atomic_load_explicit(&bucket[i], memory_order_relaxed) & key_mask) == want)
+            bits |= 1U << i;
+    }
+
+    return bits;
+#endif
+}
+
+// Returns the slot in the bucket holding a live entry matching the key bits
+// of 'want' (its value in *entry), or NULL
+static inline _Atomic uint32_t *icao_bucket_find(_Atomic uint32_t *bucket, uint32_t want, uint32_t key_mask, uint32_t gens, uint32_t *entry)
 {
-    uint32_t h, h0;
-    h0 = h = icao_hash(addr);
-    while (icao_filter_active[h] && icao_filter_active[h] != addr)
+    for (unsigned bits = icao_bucket_match(bucket, want, key_mask); bits; bits &= bits - 1)
     {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
+        _Atomic uint32_t *slot = &bucket[__builtin_ctz(bits)];
+        uint32_t e = atomic_load_explicit(slot, memory_order_relaxed);
+        if ((e & key_mask) == want && icao_stamp_live(e, gens))
         {
-            fprintf(stderr, "libreadsb: ICAO hash table full, increase ICAO_FILTER_SIZE\n");
-            return;
+            *entry = e;
+            return slot;
         }
     }
-    if (!icao_filter_active[h])
-        icao_filter_active[h] = addr;
 
-    // also add with a zeroed top byte, for handling DF20/21 with Data Parity
-    h0 = h = icao_hash(addr & 0x00ffff);
-    while (icao_filter_active[h] && (icao_filter_active[h] & 0x00ffff) != (addr & 0x00ffff))
+    return NULL;
+}
+
+// Returns the live entry matching the key bits of 'want', or 0. If
+// 'aircraft' is not NULL it is set to the entry's aircraft handle.
+static uint32_t icao_table_find(_Atomic(struct icao_table *) *table, uint32_t want, struct aircraft **aircraft)
+{
+    if (aircraft)
+        *aircraft = NULL;
+
+    for (;;)
     {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
+        unsigned moves = atomic_load_explicit(&icao_filter_moves, memory_order_acquire);
+        struct icao_table *t = atomic_load_explicit(table, memory_order_acquire);
+        uint32_t gens = atomic_load_explicit(&icao_filter_gens, memory_order_relaxed);
+        _Atomic uint32_t *slot;
+        uint32_t e;
+
+        if ((slot = icao_bucket_find(icao_bucket(t, icao_bucket1(t, want)), want, t->key_mask, gens, &e)) ||
+            (slot = icao_bucket_find(icao_bucket(t, icao_bucket2(t, want)), want, t->key_mask, gens, &e)))
         {
-            fprintf(stderr, "libreadsb: ICAO hash table full, increase ICAO_FILTER_SIZE\n");
-            return;
+            if (aircraft && t->aircraft)
+                *aircraft = atomic_load_explicit(&t->aircraft[slot - t->entries], memory_order_acquire);
+            return e;
         }
+
+        // a miss only counts if no entries moved while we looked
+        atomic_thread_fence(memory_order_acquire);
+        if (!(moves & 1) && atomic_load_explicit(&icao_filter_moves, memory_order_relaxed) == moves)
+            return 0;
     }
-    if (!icao_filter_active[h])
-        icao_filter_active[h] = addr;
 }
 
-int icao_filter_test(uint32_t addr)
+// Refresh an entry with the same key as 'entry', or claim a free or expired
+// slot for it, without locking. Returns the slot used, or NULL if neither
+// bucket has room.
+static _Atomic uint32_t *icao_table_put(struct icao_table *t, uint32_t entry, uint32_t gens)
 {
-    uint32_t h, h0;
+    uint32_t want = entry & t->key_mask;
+    _Atomic uint32_t *buckets[2] = {icao_bucket(t, icao_bucket1(t, entry)), icao_bucket(t, icao_bucket2(t, entry))};
 
-    h0 = h = icao_hash(addr);
-    while (icao_filter_a[h] && icao_filter_a[h] != addr)
+    // already present (live or expired): refresh it in place
+    for (int b = 0; b < 2; ++b)
     {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
+        for (unsigned bits = icao_bucket_match(buckets[b], want, t->key_mask); bits; bits &= bits - 1)
+        {
+            _Atomic uint32_t *slot = &buckets[b][__builtin_ctz(bits)];
+            uint32_t e = atomic_load(slot);
+
+            while (e && (e & t->key_mask) == want)
+            {
+                if (atomic_compare_exchange_weak(slot, &e, entry))
+                    return slot;
+            }
+        }
     }
-    if (icao_filter_a[h] == addr)
-        return 1;
 
-    h = h0;
-    while (icao_filter_b[h] && icao_filter_b[h] != addr)
+    for (int b = 0; b < 2; ++b)
     {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
+        for (int i = 0; i < ICAO_FILTER_BUCKET_SIZE; ++i)
+        {
+            _Atomic uint32_t *slot = &buckets[b][i];
+            uint32_t e = atomic_load(slot);
+
+            if (icao_stamp_live(e, gens))
+                continue;
+
+            // a new entry starts without an aircraft; clearing the handle
+            // of a slot someone else then claims only loses a hint
+            if (t->aircraft && atomic_load_explicit(&t->aircraft[slot - t->entries], memory_order_relaxed))
+                atomic_store_explicit(&t->aircraft[slot - t->entries], NULL, memory_order_relaxed);
+
+            if (atomic_compare_exchange_strong(slot, &e, entry))
+                return slot;
+        }
     }
-    if (icao_filter_b[h] == addr)
-        return 1;
 
-    return 0;
+    return NULL;
 }
 
-uint32_t icao_filter_test_fuzzy(uint32_t partial)
+static inline uint32_t icao_next_rand()
 {
-    uint32_t h, h0;
+    icao_filter_rand ^= icao_filter_rand << 13;
+    icao_filter_rand ^= icao_filter_rand >> 17;
+    icao_filter_rand ^= icao_filter_rand << 5;
+    return icao_filter_rand;
+}
 
-    partial &= 0x00ffff;
-    h0 = h = icao_hash(partial);
-    while (icao_filter_a[h] && (icao_filter_a[h] & 0x00ffff) != partial)
+// Make room for 'entry' by moving entries to their other bucket along a
+// random walk. The path is found first and then shifted from its free end
+// back, so a moved entry is always present in at least one of its buckets.
+// Returns the slot now holding 'entry', or NULL if no path was found or a
+// concurrent add changed a slot on it. Called with the mutex held.
+static _Atomic uint32_t *icao_table_displace(struct icao_table *t, uint32_t entry, uint32_t gens)
+{
+    _Atomic uint32_t *path[ICAO_FILTER_MAX_PATH + 1];
+    uint32_t seen[ICAO_FILTER_MAX_PATH + 1];
+    int len, found = 0, ok = 1;
+
+    path[0] = icao_bucket(t, icao_bucket1(t, entry)) + icao_next_rand() % ICAO_FILTER_BUCKET_SIZE;
+    seen[0] = atomic_load(path[0]);
+    for (len = 1; len <= ICAO_FILTER_MAX_PATH && !found; ++len)
     {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
+        uint32_t b = (path[len - 1] - t->entries) / ICAO_FILTER_BUCKET_SIZE;
+        uint32_t alt = icao_bucket1(t, seen[len - 1]);
+        _Atomic uint32_t *bucket;
+
+        if (alt == b)
+            alt = icao_bucket2(t, seen[len - 1]);
+        bucket = icao_bucket(t, alt);
+
+        for (int i = 0; i < ICAO_FILTER_BUCKET_SIZE && !found; ++i)
+        {
+            seen[len] = atomic_load(&bucket[i]);
+            if (!icao_stamp_live(seen[len], gens))
+            {
+                path[len] = &bucket[i];
+                found = 1;
+            }
+        }
+
+        if (!found)
+        {
+            // pick the next victim, avoiding slots already on the path
+            path[len] = bucket + icao_next_rand() % ICAO_FILTER_BUCKET_SIZE;
+            for (int i = 0; i < len; ++i)
+            {
+                if (path[i] == path[len])
+                    return NULL;
+            }
+            seen[len] = atomic_load(path[len]);
+        }
+    }
+
+    if (!found)
+        return NULL;
+
+    // handles follow their entry once it has landed
+    atomic_fetch_add_explicit(&icao_filter_moves, 1, memory_order_release);
+    for (int i = len - 1; i > 0 && ok; --i)
+    {
+        if ((ok = atomic_compare_exchange_strong(path[i], &seen[i], seen[i - 1])) && t->aircraft)
+            atomic_store(&t->aircraft[path[i] - t->entries], atomic_load(&t->aircraft[path[i - 1] - t->entries]));
+    }
+    if (ok && (ok = atomic_compare_exchange_strong(path[0], &seen[0], entry)) && t->aircraft)
+        atomic_store(&t->aircraft[path[0] - t->entries], NULL);
+    atomic_fetch_add_explicit(&icao_filter_moves, 1, memory_order_release);
+
+    return ok ? path[0] : NULL;
+}
+
+static void icao_table_free(struct icao_table *t);
+
+static struct icao_table *icao_table_alloc(uint32_t nbuckets, uint32_t key_mask, int with_aircraft)
+{
+    size_t n = (size_t)nbuckets * ICAO_FILTER_BUCKET_SIZE;
+    struct icao_table *t;
+
+    if (!(t = calloc(1, sizeof(*t))))
+        return NULL;
+
+    if (!(t->entries = aligned_alloc(64, n * sizeof(uint32_t))) ||
+        (with_aircraft && !(t->aircraft = calloc(n, sizeof(t->aircraft[0])))))
+    {
+        icao_table_free(t);
+        return NULL;
+    }
+
+    memset((void *)t->entries, 0, n * sizeof(uint32_t));
+    t->mask = nbuckets - 1;
+    t->key_mask = key_mask;
+    t->retired_next = NULL;
+    t->retired_flips = 0;
+    return t;
+}
+
+static void icao_table_free(struct icao_table *t)
+{
+    if (t)
+    {
+        free((void *)t->entries);
+        free((void *)t->aircraft);
+        free(t);
+    }
+}
+
+// Insert into a table nobody else can see yet, with its aircraft handle
+static int icao_table_put_private(struct icao_table *t, uint32_t entry, struct aircraft *aircraft, uint32_t gens)
+{
+    _Atomic uint32_t *slot;
+
+    if (!(slot = icao_table_put(t, entry, gens)) && !(slot = icao_table_displace(t, entry, gens)))
+        return 0;
+
+    if (t->aircraft)
+        atomic_store(&t->aircraft[slot - t->entries], aircraft);
+    return 1;
+}
+
+// Replace the table with one twice the size, dropping expired entries on
+// the way. On failure the old table stays. Called with the mutex held.
+static int icao_table_grow(_Atomic(struct icao_table *) *table, uint32_t gens)
+{
+    struct icao_table *t = atomic_load(table), *bigger = NULL;
+    uint32_t nbuckets = t->mask + 1;
+    uint32_t n = nbuckets * ICAO_FILTER_BUCKET_SIZE;
+
+    atomic_store(&icao_filter_resizing, 1);
+    while (!bigger)
+    {
+        uint32_t i;
+
+        nbuckets *= 2;
+        if (!(bigger = icao_table_alloc(nbuckets, t->key_mask, t->aircraft != NULL)))
+        {
+            atomic_store(&icao_filter_resizing, 0);
+            fprintf(stderr, "libreadsb: Out of memory growing ICAO filter\n");
+            return 0;
+        }
+
+        for (i = 0; i < n; ++i)
+        {
+            uint32_t e = atomic_load(&t->entries[i]);
+            struct aircraft *a = t->aircraft ? atomic_load(&t->aircraft[i]) : NULL;
+            if (icao_stamp_live(e, gens) && !icao_table_put_private(bigger, e, a, gens))
+                break;
+        }
+
+        if (i < n)
+        {
+            // unlucky, try again with more room
+            icao_table_free(bigger);
+            bigger = NULL;
+        }
     }
-    if ((icao_filter_a[h] & 0x00ffff) == partial)
-        return icao_filter_a[h];
 
-    h = h0;
-    while (icao_filter_b[h] && (icao_filter_b[h] & 0x00ffff) != partial)
+    atomic_store(table, bigger);
+    atomic_store(&icao_filter_resizing, 0);
+
+    t->retired_next = icao_filter_retired;
+    icao_filter_retired = t;
+    return 1;
+}
+
+static void icao_table_add(_Atomic(struct icao_table *) *table, uint32_t entry)
+{
+    struct icao_table *t = atomic_load_explicit(table, memory_order_acquire);
+    uint32_t gens = atomic_load_explicit(&icao_filter_gens, memory_order_relaxed);
+
+    // Fast path. If a resize was copying the table meanwhile our write may
+    // have been missed, so do it again under the mutex.
+    if (icao_table_put(t, entry, gens) && !atomic_load(&icao_filter_resizing) && atomic_load(table) == t)
+        return;
+
+    pthread_mutex_lock(&icao_filter_mutex);
+    for (;;)
     {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
+        t = atomic_load(table);
+        gens = atomic_load(&icao_filter_gens);
+
+        if (icao_table_put(t, entry, gens) || icao_table_displace(t, entry, gens))
+            break;
+
+        if (!icao_table_grow(table, gens))
             break;
     }
-    if ((icao_filter_b[h] & 0x00ffff) == partial)
-        return icao_filter_b[h];
+    pthread_mutex_unlock(&icao_filter_mutex);
+}
+
+// Clear entries that have aged out, so their stamps can be reused.
+// Called with the mutex held.
+static void icao_table_sweep(struct icao_table *t, uint32_t gens)
+{
+    uint32_t n = (t->mask + 1) * ICAO_FILTER_BUCKET_SIZE;
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        uint32_t e = atomic_load_explicit(&t->entries[i], memory_order_relaxed);
+        if (e && !icao_stamp_live(e, gens) && atomic_compare_exchange_strong(&t->entries[i], &e, 0) && t->aircraft)
+            atomic_store(&t->aircraft[i], NULL);
+    }
+}
+
+bool icao_filter_init()
+{
+    icao_filter_destroy();
+
+    atomic_store(&icao_filter_gens, 1);
+    atomic_store(&icao_filter_full, icao_table_alloc(ICAO_FILTER_BUCKETS, 0xffffff00, 1));
+    atomic_store(&icao_filter_partial, icao_table_alloc(ICAO_FILTER_BUCKETS, 0x00ffff00, 0));
+
+    if (!atomic_load(&icao_filter_full) || !atomic_load(&icao_filter_partial))
+    {
+        icao_filter_destroy();
+        return false;
+    }
+
+    return true;
+}
+
+void icao_filter_destroy()
+{
+    icao_table_free(atomic_exchange(&icao_filter_full, NULL));
+    icao_table_free(atomic_exchange(&icao_filter_partial, NULL));
+
+    while (icao_filter_retired)
+    {
+        struct icao_table *next = icao_filter_retired->retired_next;
+        icao_table_free(icao_filter_retired);
+        icao_filter_retired = next;
+    }
+}
+
+void icao_filter_add(uint32_t addr)
+{
+    uint32_t entry = ((addr & 0xffffff) << 8) | (atomic_load_explicit(&icao_filter_gens, memory_order_relaxed) & 0xff);
+
+    icao_table_add(&icao_filter_full, entry);
+
+    // also add keyed on the low 16 bits, for handling DF20/21 with Data Parity
+    icao_table_add(&icao_filter_partial, entry);
+}
+
+int icao_filter_test(uint32_t addr)
+{
+    return icao_table_find(&icao_filter_full, (addr & 0xffffff) << 8, NULL) != 0;
+}
+
+int icao_filter_lookup(uint32_t addr, struct aircraft **aircraft)
+{
+    return icao_table_find(&icao_filter_full, (addr & 0xffffff) << 8, aircraft) != 0;
+}
+
+// Without locking, check whether some copy of 'want' in the full table
+// holds a handle other than 'aircraft'. Like a test, a miss only counts
+// if no entries moved while we looked.
+static bool icao_filter_handle_differs(uint32_t want, struct aircraft *aircraft)
+{
+    for (;;)
+    {
+        unsigned moves = atomic_load_explicit(&icao_filter_moves, memory_order_acquire);
+        struct icao_table *t = atomic_load_explicit(&icao_filter_full, memory_order_acquire);
+
+        for (int b = 0; b < 2; ++b)
+        {
+            _Atomic uint32_t *bucket = icao_bucket(t, b ? icao_bucket2(t, want) : icao_bucket1(t, want));
+            for (unsigned bits = icao_bucket_match(bucket, want, t->key_mask); bits; bits &= bits - 1)
+            {
+                _Atomic uint32_t *slot = &bucket[__builtin_ctz(bits)];
+                if (atomic_load_explicit(slot, memory_order_relaxed) &&
+                    atomic_load_explicit(&t->aircraft[slot - t->entries], memory_order_relaxed) != aircraft)
+                    return true;
+            }
+        }
 
-    return 0;
+        atomic_thread_fence(memory_order_acquire);
+        if (!(moves & 1) && atomic_load_explicit(&icao_filter_moves, memory_order_relaxed) == moves)
+            return false;
+    }
+}
+
+void icao_filter_set_aircraft(uint32_t addr, struct aircraft *aircraft)
+{
+    uint32_t want = (addr & 0xffffff) << 8;
+    struct icao_table *t;
+    _Atomic uint32_t *buckets[2];
+
+    // Registering is a hint, called for every message that missed it: skip
+    // the mutex when the address has no slot or already has this handle.
+    // Clearing is rare and must not leave a stale handle, so it always locks.
+    if (aircraft && !icao_filter_handle_differs(want, aircraft))
+        return;
+
+    pthread_mutex_lock(&icao_filter_mutex);
+    t = atomic_load(&icao_filter_full);
+    buckets[0] = icao_bucket(t, icao_bucket1(t, want));
+    buckets[1] = icao_bucket(t, icao_bucket2(t, want));
+
+    // every copy of the address, live or not, so no copy keeps a stale handle
+    for (int b = 0; b < 2; ++b)
+    {
+        for (unsigned bits = icao_bucket_match(buckets[b], want, t->key_mask); bits; bits &= bits - 1)
+        {
+            _Atomic uint32_t *slot = &buckets[b][__builtin_ctz(bits)];
+            if (atomic_load(slot))
+                atomic_store(&t->aircraft[slot - t->entries], aircraft);
+        }
+    }
+    pthread_mutex_unlock(&icao_filter_mutex);
+}
+
+uint32_t icao_filter_test_fuzzy(uint32_t partial)
+{
+    return icao_table_find(&icao_filter_partial, (partial & 0x00ffff) << 8, NULL) >> 8;
 }
 
 // call this periodically:
@@ -142,19 +569,37 @@ void icao_filter_expire()
 {
     static uint64_t next_flip = 0;
     uint64_t now = mstime();
+    uint32_t gens, gen;
+    struct icao_table **prev;
 
+    pthread_mutex_lock(&icao_filter_mutex);
     if (now >= next_flip)
     {
-        if (icao_filter_active == icao_filter_a)
-        {
-            memset(icao_filter_b, 0, sizeof(icao_filter_b));
-            icao_filter_active = icao_filter_b;
-        }
-        else
+        gens = atomic_load(&icao_filter_gens);
+        gen = gens & 0xff;
+        gens = (gen << 8) | ((gen == 0xff) ? 1 : gen + 1);
+        atomic_store(&icao_filter_gens, gens);
+
+        icao_table_sweep(atomic_load(&icao_filter_full), gens);
+        icao_table_sweep(atomic_load(&icao_filter_partial), gens);
+
+        // free tables replaced two or more flips ago
+        prev = &icao_filter_retired;
+        while (*prev)
         {
-            memset(icao_filter_a, 0, sizeof(icao_filter_a));
-            icao_filter_active = icao_filter_a;
+            struct icao_table *t = *prev;
+            if (++t->retired_flips >= 2)
+            {
+                *prev = t->retired_next;
+                icao_table_free(t);
+            }
+            else
+            {
+                prev = &t->retired_next;
+            }
         }
+
         next_flip = now + MODES_ICAO_FILTER_TTL;
     }
+    pthread_mutex_unlock(&icao_filter_mutex);
 }
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "fifo.h"
+#include "demod_capture.h"
 #include "crc.h"
 #include "icao_filter.h"
 #include "mode_ac.h"
@@ -14,21 +16,12 @@ readsb_t lib_state;
 
 static void cleanup()
 {
-    /* Go through tracked aircraft chain and free up any used memory */
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++)
-    {
-        struct aircraft *a = lib_state.aircrafts[j], *na;
-        while (a)
-        {
-            na = a->next;
-            if (a)
-                free(a);
-            a = na;
-        }
-    }
-
+    track_cleanup();
     fifo_destroy();
+    demod_capture_destroy();
+    icao_filter_destroy();
     crc_cleanup_tables();
+    geomag_destroy();
 }
 
 enum error_no readsb_init(readsb_config_t *config)
@@ -47,10 +40,32 @@ enum error_no readsb_init(readsb_config_t *config)
         lib_state.config.altitude = 0;
         lib_state.config.latitude = 0.0;
         lib_state.config.longitude = 0.0;
+        lib_state.config.sample_rate = 0;
+        lib_state.config.demod_overlap = 0;
+        lib_state.config.demod_capture_size = 0;
+        lib_state.config.demod_capture_rate = 1;
+        lib_state.config.aircraft_prealloc = 0;
+        lib_state.config.maintenance_budget = 0;
+        lib_state.config.max_aircraft = 0;
         fprintf(stderr, "libreadsb: Using default configuration\n");
     }
 
-    lib_state.sample_rate = (double)2400000.0;
+    // 2.4MHz uses the phase-tracking demodulator, higher rates need a whole
+    // number of samples per half-bit for the high-rate demodulator.
+    if (lib_state.config.sample_rate == 0 || lib_state.config.sample_rate == 2400000)
+    {
+        lib_state.sample_rate = (double)2400000.0;
+    }
+    else if (lib_state.config.sample_rate >= 6000000 && lib_state.config.sample_rate <= 24000000 &&
+             lib_state.config.sample_rate % 2000000 == 0)
+    {
+        lib_state.sample_rate = (double)lib_state.config.sample_rate;
+    }
+    else
+    {
+        fprintf(stderr, "libreadsb: Unsupported sample rate %u Hz\n", lib_state.config.sample_rate);
+        return ERR_FAILURE;
+    }
 
     // Allocate the various buffers used by Modes
     lib_state.trailing_samples = (MODES_PREAMBLE_US + MODES_LONG_MSG_BITS + 16) * 1e-6 * lib_state.sample_rate;
@@ -61,6 +76,16 @@ enum error_no readsb_init(readsb_config_t *config)
         return ERR_FAILURE;
     }
 
+    // Captured windows start at the preamble, which the high-rate demodulator may
+    // have moved up to a chip past the end of the block: leave 1us of slack
+    if (lib_state.config.demod_capture_size &&
+        !demod_capture_init(lib_state.config.demod_capture_size, lib_state.config.demod_capture_rate,
+                            lib_state.trailing_samples - (unsigned)(lib_state.sample_rate / 1e6)))
+    {
+        fprintf(stderr, "libreadsb: Out of memory allocating demodulator capture\n");
+        return ERR_FAILURE;
+    }
+
     // Validate the users Lat/Lon home location inputs
     if ((lib_state.config.latitude > 90.0)      // Latitude must be -90 to +90
         || (lib_state.config.latitude < -90.0)  // and
@@ -83,10 +108,23 @@ enum error_no readsb_init(readsb_config_t *config)
     {
         lib_state.bUserFlags |= MODES_USER_LATLON_VALID;
     }
+    lib_state.receiver.lat = lib_state.config.latitude * M_PI / 180.0;
+    lib_state.receiver.lon = lib_state.config.longitude * M_PI / 180.0;
+    lib_state.receiver.sin_lat = sin(lib_state.receiver.lat);
+    lib_state.receiver.cos_lat = cos(lib_state.receiver.lat);
 
     // Prepare error correction tables
     modes_checksum_init(lib_state.config.nfix_crc);
-    icao_filter_init();
+    if (!icao_filter_init())
+    {
+        fprintf(stderr, "libreadsb: Out of memory allocating ICAO filter\n");
+        return ERR_FAILURE;
+    }
+    if (!track_init())
+    {
+        fprintf(stderr, "libreadsb: Out of memory allocating aircraft table\n");
+        return ERR_FAILURE;
+    }
     mode_ac_init();
     geomag_init();
 
@@ -110,4 +148,55 @@ void readsb_close()
     lib_state.is_exit = 1;
 
     cleanup();
-}
\ No newline at end of file
+}
+
+unsigned readsb_get_aircraft_count()
+{
+    return lib_state.aircrafts.count;
+}
+
+void *readsb_get_aircraft_by_address(unsigned addr)
+{
+    return track_find_aircraft(addr);
+}
+
+void readsb_get_aircraft_pool_stats(readsb_pool_stats_t *pool)
+{
+    pool->used = lib_state.aircraft_pool.used;
+    pool->allocated = lib_state.aircraft_pool.allocated;
+    pool->high_water = lib_state.aircraft_pool.high_water;
+}
+
+enum error_no readsb_get_latency(enum latency_stage stage, readsb_latency_t *latency)
+{
+    const struct latency_hist *h;
+
+    switch (stage)
+    {
+    case LATENCY_BLOCK_TO_DEMOD:
+        h = &lib_state.stats_current.latency_block_to_demod;
+        break;
+    case LATENCY_DEMOD_TO_DECODE:
+        h = &lib_state.stats_current.latency_demod_to_decode;
+        break;
+    case LATENCY_DECODE_TO_TRACK:
+        h = &lib_state.stats_current.latency_decode_to_track;
+        break;
+    case LATENCY_BLOCK:
+        h = &lib_state.stats_current.latency_block;
+        break;
+    case LATENCY_MAINTENANCE:
+        h = &lib_state.stats_current.latency_maintenance;
+        break;
+    default:
+        return ERR_FAILURE;
+    }
+
+    latency->count = h->count;
+    latency->mean = h->count ? (uint32_t)(h->sum / h->count) : 0;
+    latency->p50 = latency_hist_percentile(h, 50.0);
+    latency->p90 = latency_hist_percentile(h, 90.0);
+    latency->p99 = latency_hist_percentile(h, 99.0);
+    latency->max = h->max;
+    return ERR_SUCCESS;
+}
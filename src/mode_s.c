@@ -9,6 +9,9 @@
 #include "comm_b.h"
 #include "mode_ac.h"
 #include "mode_s.h"
+#include "track.h"
+#include "trace.h"
+#include "util.h"
 
 /* A timestamp that indicates the data is synthetic, created from a
  * multilateration result
@@ -231,7 +234,7 @@ static float decode_movement_field_v0(unsigned movement)
  * syndrome. Updates *addr and returns >0 if changed, 0 if
  * it was unaffected.
  */
-static int correct_aa_field(uint32_t *addr, struct errorinfo *ei)
+static int correct_aa_field(uint32_t *addr, const struct errorinfo *ei)
 {
     int i;
     int addr_errors = 0;
@@ -279,11 +282,15 @@ static int correct_aa_field(uint32_t *addr, struct errorinfo *ei)
  */
 static unsigned char all_zeros[14] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-int score_modes_message(unsigned char *msg, int validbits)
+int score_modes_message(unsigned char *msg, int validbits, modes_score_t *result)
 {
     int msgtype, msgbits, crc, iid;
     uint32_t addr;
-    struct errorinfo *ei;
+    const struct errorinfo *ei;
+    modes_score_t scratch;
+
+    if (!result)
+        result = &scratch;
 
     if (validbits < 56)
         return -2;
@@ -298,6 +305,9 @@ int score_modes_message(unsigned char *msg, int validbits)
         return -2;
 
     crc = modes_checksum(msg, msgbits);
+    result->crc = crc;
+    result->ei = NULL;
+    result->aircraft = NULL;
 
     switch (msgtype)
     {
@@ -313,7 +323,9 @@ int score_modes_message(unsigned char *msg, int validbits)
     case 29: // Comm-D (ELM)
     case 30: // Comm-D (ELM)
     case 31: // Comm-D (ELM)
-        return icao_filter_test(crc) ? 1000 : -1;
+        result->addr = crc;
+        result->filter_hit = icao_filter_lookup(crc, &result->aircraft);
+        return result->filter_hit ? 1000 : -1;
 
     case 11: // All-call reply
         iid = crc & 0x7f;
@@ -333,17 +345,21 @@ int score_modes_message(unsigned char *msg, int validbits)
         // fix any errors in the address field
         correct_aa_field(&addr, ei);
 
+        result->ei = ei;
+        result->addr = addr;
+        result->filter_hit = icao_filter_lookup(addr, &result->aircraft);
+
         // validate address
         if (iid == 0)
         {
-            if (icao_filter_test(addr))
+            if (result->filter_hit)
                 return 1600 / (ei->errors + 1);
             else
                 return 750 / (ei->errors + 1);
         }
         else
         {
-            if (icao_filter_test(addr))
+            if (result->filter_hit)
                 return 1000 / (ei->errors + 1);
             else
                 return -1;
@@ -359,14 +375,20 @@ int score_modes_message(unsigned char *msg, int validbits)
         addr = getbits(msg, 9, 32);
         correct_aa_field(&addr, ei);
 
-        if (icao_filter_test(addr))
+        result->ei = ei;
+        result->addr = addr;
+        result->filter_hit = icao_filter_lookup(addr, &result->aircraft);
+
+        if (result->filter_hit)
             return 1800 / (ei->errors + 1);
         else
             return 1400 / (ei->errors + 1);
 
     case 20: // Comm-B, altitude reply
     case 21: // Comm-B, identity reply
-        if (icao_filter_test(crc))
+        result->addr = crc;
+        result->filter_hit = icao_filter_lookup(crc, &result->aircraft);
+        if (result->filter_hit)
             return 1000; // Address/Parity
 
 #if 0
@@ -392,11 +414,15 @@ static void decode_extended_squitter(modes_message_t *mm);
 /* return 0 if all OK
  * -1: message might be valid, but we couldn't validate the CRC against a known ICAO
  * -2: bad message or unrepairable CRC error
+ *
+ * If 'score' is not NULL it holds the checksum results from scoring these
+ * same bytes, which are used instead of recomputing them.
  */
-int decode_modes_message(modes_message_t *mm, unsigned char *msg)
+static int decode_message(modes_message_t *mm, unsigned char *msg, const modes_score_t *score)
 {
     // Work on our local copy.
     memcpy(mm->msg, msg, MODES_LONG_MSG_BYTES);
+    memcpy(mm->verbatim, msg, MODES_LONG_MSG_BYTES);
     msg = mm->msg;
 
     // don't accept all-zeros messages
@@ -406,7 +432,8 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
     // Get the message type ASAP as other operations depend on this
     mm->msgtype = getbits(msg, 1, 5); // Downlink Format
     mm->msgbits = modes_message_len_by_type(mm->msgtype);
-    mm->crc = modes_checksum(msg, mm->msgbits);
+    mm->crc = score ? score->crc : modes_checksum(msg, mm->msgbits);
+    mm->aircraft = score ? score->aircraft : NULL;
     mm->correctedbits = 0;
     mm->addr = 0;
 
@@ -428,7 +455,7 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
         // These message types use Address/Parity, i.e. our CRC syndrome is the sender's ICAO address.
         // We can't tell if the CRC is correct or not as we don't know the correct address.
         // Accept the message if it appears to be from a previously-seen aircraft
-        if (!icao_filter_test(mm->crc))
+        if (!(score ? score->filter_hit : icao_filter_test(mm->crc)))
         {
             return -1;
         }
@@ -447,7 +474,7 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
         if (mm->crc & 0xffff80)
         {
             int addr;
-            struct errorinfo *ei = modes_checksum_diagnose(mm->crc & 0xffff80, mm->msgbits);
+            const struct errorinfo *ei = score ? score->ei : modes_checksum_diagnose(mm->crc & 0xffff80, mm->msgbits);
             if (!ei)
             {
                 return -2; // couldn't fix it
@@ -466,7 +493,7 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
             // we are conservative here: only accept corrected messages that
             // match an existing aircraft.
             addr = getbits(msg, 9, 32);
-            if (!icao_filter_test(addr))
+            if (!(score ? score->filter_hit : icao_filter_test(addr)))
             {
                 return -1;
             }
@@ -477,14 +504,14 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
     case 17: // Extended squitter
     case 18:
     { // Extended squitter/non-transponder
-        struct errorinfo *ei;
+        const struct errorinfo *ei;
         int addr1, addr2;
 
         // These message types use Parity/Interrogator, but are specified to set II=0
 
         if (mm->crc != 0)
         {
-            ei = modes_checksum_diagnose(mm->crc, mm->msgbits);
+            ei = score ? score->ei : modes_checksum_diagnose(mm->crc, mm->msgbits);
             if (!ei)
             {
                 return -2; // couldn't fix it
@@ -497,7 +524,7 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
 
             // we are conservative here: only accept corrected messages that
             // match an existing aircraft.
-            if (addr1 != addr2 && !icao_filter_test(addr2))
+            if (addr1 != addr2 && !(score ? score->filter_hit : icao_filter_test(addr2)))
             {
                 return -1;
             }
@@ -515,7 +542,7 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
         // the ICAO is right! Ow.
 
         // Try an exact match
-        if (icao_filter_test(mm->crc))
+        if (score ? score->filter_hit : icao_filter_test(mm->crc))
         {
             // OK.
             mm->source = SOURCE_MODE_S;
@@ -734,6 +761,13 @@ int decode_modes_message(modes_message_t *mm, unsigned char *msg)
     return 0;
 }
 
+int decode_modes_message(modes_message_t *mm, unsigned char *msg, const modes_score_t *score)
+{
+    int result = decode_message(mm, msg, score);
+    READSB_TRACE3(decode, mm->msgtype, mm->addr, result);
+    return result;
+}
+
 static void decode_es_ident_category(modes_message_t *mm)
 {
     // Aircraft Identification and Category
@@ -1602,5 +1636,8 @@ void use_modes_message(modes_message_t *mm)
     ++lib_state.stats_current.messages_total;
 
     // Track aircraft state
-    a = trackUpdateFromMessage(mm);
+    a = track_update_from_message(mm);
+
+    if (mm->decodedUs)
+        latency_hist_add(&lib_state.stats_current.latency_decode_to_track, ustime() - mm->decodedUs);
 }
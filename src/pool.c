@@ -0,0 +1,99 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_ALIGN 64
+
+struct pool_slab
+{
+    struct pool_slab *next;
+    unsigned char *objects;
+};
+
+// Allocate a slab and push its objects on the freelist, first object on top
+static bool pool_grow(struct pool *p)
+{
+    struct pool_slab *slab;
+
+    if (!(slab = malloc(sizeof(*slab))))
+        return false;
+    if (!(slab->objects = aligned_alloc(POOL_ALIGN, p->size * p->per_slab)))
+    {
+        free(slab);
+        return false;
+    }
+
+    for (unsigned i = p->per_slab; i-- > 0;)
+    {
+        void *obj = slab->objects + i * p->size;
+        *(void **)obj = p->free;
+        p->free = obj;
+    }
+
+    slab->next = p->slabs;
+    p->slabs = slab;
+    p->allocated += p->per_slab;
+    return true;
+}
+
+bool pool_init(struct pool *p, size_t size, unsigned per_slab, unsigned prealloc)
+{
+    memset(p, 0, sizeof(*p));
+
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+    p->size = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    p->per_slab = per_slab ? per_slab : 1;
+
+    while (p->allocated < prealloc)
+    {
+        if (!pool_grow(p))
+        {
+            pool_destroy(p);
+            return false;
+        }
+    }
+    return true;
+}
+
+void pool_destroy(struct pool *p)
+{
+    struct pool_slab *slab, *next;
+
+    for (slab = p->slabs; slab; slab = next)
+    {
+        next = slab->next;
+        free(slab->objects);
+        free(slab);
+    }
+
+    p->slabs = NULL;
+    p->free = NULL;
+    p->allocated = p->used = 0;
+}
+
+void *pool_alloc(struct pool *p)
+{
+    void *obj;
+
+    if (!p->free && !pool_grow(p))
+        return NULL;
+
+    obj = p->free;
+    p->free = *(void **)obj;
+
+    if (++p->used > p->high_water)
+        p->high_water = p->used;
+    return obj;
+}
+
+void pool_free(struct pool *p, void *obj)
+{
+    if (!obj)
+        return;
+
+    *(void **)obj = p->free;
+    p->free = obj;
+    p->used--;
+}
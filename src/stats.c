@@ -1,5 +1,74 @@
 #include "stats.h"
 
+static unsigned latency_bucket(uint32_t v)
+{
+    unsigned e;
+
+    if (v < LATENCY_HIST_SUB_BUCKETS)
+        return v;
+
+    e = 31 - __builtin_clz(v); // >= LATENCY_HIST_SUB_BITS
+    return (e - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB_BUCKETS +
+           ((v >> (e - LATENCY_HIST_SUB_BITS)) & (LATENCY_HIST_SUB_BUCKETS - 1));
+}
+
+// Largest value falling in bucket b
+static uint32_t latency_bucket_upper(unsigned b)
+{
+    unsigned e, sub;
+
+    if (b < LATENCY_HIST_SUB_BUCKETS)
+        return b;
+
+    e = b / LATENCY_HIST_SUB_BUCKETS + LATENCY_HIST_SUB_BITS - 1;
+    sub = b % LATENCY_HIST_SUB_BUCKETS;
+    return (uint32_t)((((uint64_t)LATENCY_HIST_SUB_BUCKETS + sub + 1) << (e - LATENCY_HIST_SUB_BITS)) - 1);
+}
+
+void latency_hist_add(struct latency_hist *h, uint64_t us)
+{
+    uint32_t v = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+
+    h->buckets[latency_bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+void latency_hist_merge(const struct latency_hist *h1, const struct latency_hist *h2, struct latency_hist *target)
+{
+    for (int i = 0; i < LATENCY_HIST_BUCKETS; ++i)
+        target->buckets[i] = h1->buckets[i] + h2->buckets[i];
+    target->count = h1->count + h2->count;
+    target->sum = h1->sum + h2->sum;
+    target->max = h1->max > h2->max ? h1->max : h2->max;
+}
+
+uint32_t latency_hist_percentile(const struct latency_hist *h, double pct)
+{
+    uint64_t rank, seen = 0;
+
+    if (!h->count)
+        return 0;
+
+    rank = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    for (int i = 0; i < LATENCY_HIST_BUCKETS; ++i)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            uint32_t upper = latency_bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+
+    return h->max;
+}
+
 void add_timespecs(const struct timespec *x, const struct timespec *y, struct timespec *z)
 {
     z->tv_sec = x->tv_sec + y->tv_sec;
@@ -34,6 +103,7 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->demod_rejected_unknown_icao = st1->demod_rejected_unknown_icao + st2->demod_rejected_unknown_icao;
     for (i = 0; i < MODES_MAX_BITERRORS + 1; ++i)
         target->demod_accepted[i] = st1->demod_accepted[i] + st2->demod_accepted[i];
+    target->demod_recovered = st1->demod_recovered + st2->demod_recovered;
     target->demod_modeac = st1->demod_modeac + st2->demod_modeac;
 
     target->samples_processed = st1->samples_processed + st2->samples_processed;
@@ -96,10 +166,21 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->with_positions = st1->with_positions;
     target->mlat_positions = st1->mlat_positions;
     target->tisb_positions = st1->tisb_positions;
+    target->aircraft_pool_used = st1->aircraft_pool_used;
+    target->aircraft_pool_allocated = st1->aircraft_pool_allocated;
+    target->aircraft_pool_high_water = st1->aircraft_pool_high_water > st2->aircraft_pool_high_water ? st1->aircraft_pool_high_water : st2->aircraft_pool_high_water;
+    target->aircraft_evicted = st1->aircraft_evicted + st2->aircraft_evicted;
 
     // Longest Distance observed
     if (st1->longest_distance > st2->longest_distance)
         target->longest_distance = st1->longest_distance;
     else
         target->longest_distance = st2->longest_distance;
+
+    // pipeline latency
+    latency_hist_merge(&st1->latency_block_to_demod, &st2->latency_block_to_demod, &target->latency_block_to_demod);
+    latency_hist_merge(&st1->latency_demod_to_decode, &st2->latency_demod_to_decode, &target->latency_demod_to_decode);
+    latency_hist_merge(&st1->latency_decode_to_track, &st2->latency_decode_to_track, &target->latency_decode_to_track);
+    latency_hist_merge(&st1->latency_block, &st2->latency_block, &target->latency_block);
+    latency_hist_merge(&st1->latency_maintenance, &st2->latency_maintenance, &target->latency_maintenance);
 }
@@ -1,27 +1,99 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 #include "cpr.h"
 #include "geomag.h"
+#include "icao_filter.h"
 #include "mode_ac.h"
+#include "mode_s.h"
 #include "track.h"
+#include "trace.h"
 
 uint32_t modeAC_count[4096];
 uint32_t modeAC_lastcount[4096];
 uint32_t modeAC_match[4096];
 uint32_t modeAC_age[4096];
 
+// aircraft that could be answering each Mode A/C code, and the codes heard
+static struct modeac_link *modeAC_aircraft[4096];
+static uint16_t modeAC_active[4096];
+static unsigned modeAC_active_count;
+
+/* Progress of the Mode A/C matching pass, see track_match_ac() */
+static struct
+{
+    enum
+    {
+        MATCH_AC_IDLE = 0,
+        MATCH_AC_CODES // handling modeAC_active[] from 'index' down
+    } phase;
+    unsigned index;
+} match_ac_pass;
+
+static uint64_t track_next_update; // when the once a second maintenance is next due
+
+/* How long after an update data goes stale and expires, per field */
+const struct validity_interval track_validity_intervals[VALIDITY_FIELDS] = {
+    [VALIDITY_DEFAULT] = {60 * 1000, 70 * 1000},          // emergency, alert, SPI
+    [VALIDITY_CALLSIGN] = {60 * 1000, 70 * 1000},         // ADS-B or Comm-B
+    [VALIDITY_ALTITUDE_BARO] = {15 * 1000, 70 * 1000},    // ADS-B or Mode S
+    [VALIDITY_ALTITUDE_GEOM] = {60 * 1000, 70 * 1000},    // ADS-B only
+    [VALIDITY_GEOM_DELTA] = {60 * 1000, 70 * 1000},       // ADS-B only
+    [VALIDITY_GS] = {60 * 1000, 70 * 1000},               // ADS-B or Comm-B
+    [VALIDITY_IAS] = {60 * 1000, 70 * 1000},              // ADS-B (rare) or Comm-B
+    [VALIDITY_TAS] = {60 * 1000, 70 * 1000},              // ADS-B (rare) or Comm-B
+    [VALIDITY_MACH] = {60 * 1000, 70 * 1000},             // Comm-B only
+    [VALIDITY_TRACK] = {60 * 1000, 70 * 1000},            // ADS-B or Comm-B
+    [VALIDITY_TRACK_RATE] = {60 * 1000, 70 * 1000},       // Comm-B only
+    [VALIDITY_ROLL] = {60 * 1000, 70 * 1000},             // Comm-B only
+    [VALIDITY_MAG_HEADING] = {60 * 1000, 70 * 1000},      // ADS-B (rare) or Comm-B
+    [VALIDITY_TRUE_HEADING] = {60 * 1000, 70 * 1000},     // ADS-B only (rare)
+    [VALIDITY_BARO_RATE] = {60 * 1000, 70 * 1000},        // ADS-B or Comm-B
+    [VALIDITY_GEOM_RATE] = {60 * 1000, 70 * 1000},        // ADS-B or Comm-B
+    [VALIDITY_SQUAWK] = {15 * 1000, 70 * 1000},           // ADS-B or Mode S
+    [VALIDITY_AIRGROUND] = {15 * 1000, 70 * 1000},        // ADS-B or Mode S
+    [VALIDITY_NAV_QNH] = {60 * 1000, 70 * 1000},          // Comm-B only
+    [VALIDITY_NAV_ALTITUDE_MCP] = {60 * 1000, 70 * 1000}, // ADS-B or Comm-B
+    [VALIDITY_NAV_ALTITUDE_FMS] = {60 * 1000, 70 * 1000}, // ADS-B or Comm-B
+    [VALIDITY_NAV_ALTITUDE_SRC] = {60 * 1000, 70 * 1000}, // ADS-B or Comm-B
+    [VALIDITY_NAV_HEADING] = {60 * 1000, 70 * 1000},      // ADS-B or Comm-B
+    [VALIDITY_NAV_MODES] = {60 * 1000, 70 * 1000},        // ADS-B or Comm-B
+    [VALIDITY_CPR_ODD] = {60 * 1000, 70 * 1000},          // ADS-B only
+    [VALIDITY_CPR_EVEN] = {60 * 1000, 70 * 1000},         // ADS-B only
+    [VALIDITY_POSITION] = {60 * 1000, 70 * 1000},         // ADS-B only
+    [VALIDITY_NIC_A] = {60 * 1000, 70 * 1000},            // ADS-B only
+    [VALIDITY_NIC_C] = {60 * 1000, 70 * 1000},            // ADS-B only
+    [VALIDITY_NIC_BARO] = {60 * 1000, 70 * 1000},         // ADS-B only
+    [VALIDITY_NAC_P] = {60 * 1000, 70 * 1000},            // ADS-B only
+    [VALIDITY_NAC_V] = {60 * 1000, 70 * 1000},            // ADS-B only
+    [VALIDITY_SIL] = {60 * 1000, 70 * 1000},              // ADS-B only
+    [VALIDITY_GVA] = {60 * 1000, 70 * 1000},              // ADS-B only
+    [VALIDITY_SDA] = {60 * 1000, 70 * 1000},              // ADS-B only
+};
+
 /* Return a new aircraft structure for the linked list of tracked aircraft.
  */
 static struct aircraft *track_create_aircraft(modes_message_t *mm)
 {
     static struct aircraft zeroAircraft;
-    struct aircraft *a = (struct aircraft *)malloc(sizeof(*a));
+    static struct aircraft_cold zeroCold;
+    struct aircraft *a = (struct aircraft *)pool_alloc(&lib_state.aircraft_pool);
+    struct aircraft_cold *cold = (struct aircraft_cold *)pool_alloc(&lib_state.aircraft_cold_pool);
     int i;
 
+    if (!a || !cold)
+    {
+        pool_free(&lib_state.aircraft_pool, a);
+        pool_free(&lib_state.aircraft_cold_pool, cold);
+        return NULL;
+    }
+
     // Default everything to zero/NULL
     *a = zeroAircraft;
+    *cold = zeroCold;
+    a->cold = cold;
 
     // Now initialise things that should not be 0/NULL to their defaults
     a->addr = mm->addr;
@@ -34,95 +106,397 @@ static struct aircraft *track_create_aircraft(modes_message_t *mm)
     a->adsb_version = -1;
     a->adsb_hrd = HEADING_MAGNETIC;
     a->adsb_tah = HEADING_GROUND_TRACK;
-    // Copy the first message so we can emit it later when a second message arrives.
-    a->first_message = *mm;
-
-    // initialize data validity ages
-#define F(f, s, e)                               \
-    do                                           \
-    {                                            \
-        a->f##_valid.stale_interval = (s)*1000;  \
-        a->f##_valid.expire_interval = (e)*1000; \
-    } while (0)
-    F(callsign, 60, 70);         // ADS-B or Comm-B
-    F(altitude_baro, 15, 70);    // ADS-B or Mode S
-    F(altitude_geom, 60, 70);    // ADS-B only
-    F(geom_delta, 60, 70);       // ADS-B only
-    F(gs, 60, 70);               // ADS-B or Comm-B
-    F(ias, 60, 70);              // ADS-B (rare) or Comm-B
-    F(tas, 60, 70);              // ADS-B (rare) or Comm-B
-    F(mach, 60, 70);             // Comm-B only
-    F(track, 60, 70);            // ADS-B or Comm-B
-    F(track_rate, 60, 70);       // Comm-B only
-    F(roll, 60, 70);             // Comm-B only
-    F(mag_heading, 60, 70);      // ADS-B (rare) or Comm-B
-    F(true_heading, 60, 70);     // ADS-B only (rare)
-    F(baro_rate, 60, 70);        // ADS-B or Comm-B
-    F(geom_rate, 60, 70);        // ADS-B or Comm-B
-    F(squawk, 15, 70);           // ADS-B or Mode S
-    F(airground, 15, 70);        // ADS-B or Mode S
-    F(nav_qnh, 60, 70);          // Comm-B only
-    F(nav_altitude_mcp, 60, 70); // ADS-B or Comm-B
-    F(nav_altitude_fms, 60, 70); // ADS-B or Comm-B
-    F(nav_altitude_src, 60, 70); // ADS-B or Comm-B
-    F(nav_heading, 60, 70);      // ADS-B or Comm-B
-    F(nav_modes, 60, 70);        // ADS-B or Comm-B
-    F(cpr_odd, 60, 70);          // ADS-B only
-    F(cpr_even, 60, 70);         // ADS-B only
-    F(position, 60, 70);         // ADS-B only
-    F(nic_a, 60, 70);            // ADS-B only
-    F(nic_c, 60, 70);            // ADS-B only
-    F(nic_baro, 60, 70);         // ADS-B only
-    F(nac_p, 60, 70);            // ADS-B only
-    F(nac_v, 60, 70);            // ADS-B only
-    F(sil, 60, 70);              // ADS-B only
-    F(gva, 60, 70);              // ADS-B only
-    F(sda, 60, 70);              // ADS-B only
-#undef F
 
-    lib_state.stats_current.unique_aircraft++;
+    // tag the data validity records with their fields; f may name a field of the cold record
+#define F(f, e) a->f##_valid.field = VALIDITY_##e
+    F(callsign, CALLSIGN);
+    F(altitude_baro, ALTITUDE_BARO);
+    F(altitude_geom, ALTITUDE_GEOM);
+    F(geom_delta, GEOM_DELTA);
+    F(gs, GS);
+    F(cold->ias, IAS);
+    F(cold->tas, TAS);
+    F(cold->mach, MACH);
+    F(track, TRACK);
+    F(cold->track_rate, TRACK_RATE);
+    F(cold->roll, ROLL);
+    F(mag_heading, MAG_HEADING);
+    F(true_heading, TRUE_HEADING);
+    F(baro_rate, BARO_RATE);
+    F(geom_rate, GEOM_RATE);
+    F(squawk, SQUAWK);
+    F(airground, AIRGROUND);
+    F(cold->nav_qnh, NAV_QNH);
+    F(cold->nav_altitude_mcp, NAV_ALTITUDE_MCP);
+    F(cold->nav_altitude_fms, NAV_ALTITUDE_FMS);
+    F(cold->nav_altitude_src, NAV_ALTITUDE_SRC);
+    F(cold->nav_heading, NAV_HEADING);
+    F(cold->nav_modes, NAV_MODES);
+    F(cpr_odd, CPR_ODD);
+    F(cpr_even, CPR_EVEN);
+    F(position, POSITION);
+    F(nic_a, NIC_A);
+    F(nic_c, NIC_C);
+    F(cold->nic_baro, NIC_BARO);
+    F(cold->nac_p, NAC_P);
+    F(cold->nac_v, NAC_V);
+    F(cold->sil, SIL);
+    F(cold->gva, GVA);
+    F(cold->sda, SDA);
+#undef F
 
     return (a);
 }
 
+/* Give an aircraft's records back to the pools.
+ */
+static void track_release_aircraft(struct aircraft *a)
+{
+    pool_free(&lib_state.aircraft_cold_pool, a->cold);
+    pool_free(&lib_state.aircraft_pool, a);
+}
+
+/* Table keys are the address with the top bit set, so that address
+ * 000000 is distinct from an empty slot (0).
+ */
+#define TRACK_KEY(addr) ((addr) | 0x80000000U)
+
+/* Home slot of a key in the aircraft table. ICAO addresses are
+ * allocated in per-country blocks, so mix all the bits before masking.
+ */
+static inline uint32_t track_slot(uint32_t key, uint32_t mask)
+{
+    // murmur3 finalizer
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key & mask;
+}
+
 /* Return the aircraft with the specified address, or NULL if no aircraft
  * exists with this address.
  */
-static struct aircraft *track_find_aircraft(uint32_t addr)
+struct aircraft *track_find_aircraft(uint32_t addr)
 {
-    struct aircraft *a = lib_state.aircrafts[addr % AIRCRAFTS_BUCKETS];
+    struct aircraft_table *t = &lib_state.aircrafts;
+    uint32_t key = TRACK_KEY(addr);
+    uint32_t i;
 
-    while (a)
+    for (i = track_slot(key, t->mask); t->keys[i]; i = (i + 1) & t->mask)
     {
-        if (a->addr == addr)
-            return (a);
-        a = a->next;
+        if (t->keys[i] == key)
+            return t->aircraft[i];
     }
     return (NULL);
 }
 
+static bool track_table_alloc(struct aircraft_table *t, uint32_t size)
+{
+    if (!(t->keys = calloc(size, sizeof(t->keys[0]))) ||
+        !(t->aircraft = calloc(size, sizeof(t->aircraft[0]))))
+    {
+        free(t->keys);
+        t->keys = NULL;
+        return false;
+    }
+    t->mask = size - 1;
+    return true;
+}
+
+/* Double the table; on failure the old one stays. */
+static bool track_table_grow(struct aircraft_table *t)
+{
+    struct aircraft_table bigger = *t;
+
+    if (!track_table_alloc(&bigger, (t->mask + 1) * 2))
+        return false;
+
+    for (struct aircraft *a = t->first; a; a = a->next)
+    {
+        uint32_t i = track_slot(TRACK_KEY(a->addr), bigger.mask);
+        while (bigger.keys[i])
+            i = (i + 1) & bigger.mask;
+        bigger.keys[i] = TRACK_KEY(a->addr);
+        bigger.aircraft[i] = a;
+    }
+
+    free(t->keys);
+    free(t->aircraft);
+    *t = bigger;
+    return true;
+}
+
+#define WHEEL_SLOTS (1 << AIRCRAFTS_WHEEL_BITS)
+#define WHEEL_SPAN ((uint64_t)1 << (AIRCRAFTS_WHEEL_BITS * AIRCRAFTS_WHEEL_LEVELS))
+
+// shortest expiry interval of any field, set up by track_init()
+static uint32_t track_min_expire;
+
+/* Take an aircraft out of its timer wheel slot, if any.
+ */
+static void track_wheel_unlink(struct aircraft *a)
+{
+    if (!a->wheel_pprev)
+        return;
+
+    *a->wheel_pprev = a->wheel_next;
+    if (a->wheel_next)
+        a->wheel_next->wheel_pprev = a->wheel_pprev;
+    a->wheel_next = NULL;
+    a->wheel_pprev = NULL;
+}
+
+/* Put an aircraft in the timer wheel, to be visited at second 'due'.
+ * Seconds already processed mean the current one; seconds beyond the
+ * wheel are clamped to its end, and the visit then reschedules.
+ */
+static void track_wheel_insert(struct aircraft *a, uint64_t due)
+{
+    struct aircraft_wheel *w = &lib_state.aircraft_wheel;
+    struct aircraft **slot;
+    uint64_t delta;
+    int level;
+
+    if (due < w->tick)
+        due = w->tick;
+    delta = due - w->tick;
+    if (delta >= WHEEL_SPAN)
+    {
+        due = w->tick + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+
+    for (level = 0; level < AIRCRAFTS_WHEEL_LEVELS - 1 && delta >> (AIRCRAFTS_WHEEL_BITS * (level + 1)); ++level)
+        ;
+
+    slot = &w->slots[level][(due >> (AIRCRAFTS_WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    a->wheel_due = due;
+    a->wheel_next = *slot;
+    a->wheel_pprev = slot;
+    if (*slot)
+        (*slot)->wheel_pprev = &a->wheel_next;
+    *slot = a;
+}
+
+/* Data accepted from a message can expire no sooner than the shortest
+ * expiry interval after it; bring the aircraft's visit forward if it is
+ * scheduled later than that, so expired fields are dropped on time.
+ */
+static void track_wheel_reschedule(struct aircraft *a)
+{
+    uint64_t due = (messageNow() + track_min_expire) / 1000;
+
+    if (due >= a->wheel_due || !a->wheel_pprev)
+        return;
+    if (due <= lib_state.aircraft_wheel.tick)
+        due = lib_state.aircraft_wheel.tick + 1;
+
+    track_wheel_unlink(a);
+    track_wheel_insert(a, due);
+}
+
+/* Take an aircraft out of the list of one Mode A/C code, if it is in one */
+static void track_modeac_unfile(struct modeac_link *l)
+{
+    if (!l->pprev)
+        return;
+
+    *l->pprev = l->next;
+    if (l->next)
+        l->next->pprev = l->pprev;
+    l->next = NULL;
+    l->pprev = NULL;
+}
+
+/* Put an aircraft in the list of the Mode A/C code with the given index */
+static void track_modeac_file(struct aircraft *a, struct modeac_link *l, unsigned index)
+{
+    struct modeac_link **head = &modeAC_aircraft[index];
+
+    track_modeac_unfile(l);
+    l->aircraft = a;
+    l->next = *head;
+    l->pprev = head;
+    if (*head)
+        (*head)->pprev = &l->next;
+    *head = l;
+}
+
+/* File an aircraft under the Mode C levels of its barometric altitude
+ * and the ones either side of it (+/- 100ft). Each level keeps to the
+ * link picked by its value modulo 3, so a climb or descent through one
+ * level only moves one link.
+ */
+static void track_modeac_file_altitude(struct aircraft *a)
+{
+    struct aircraft_cold *cold = a->cold;
+    int modeC = (a->alt_baro + 49) / 100;
+
+    if (a->modeac_level_filed && a->modeac_level == modeC)
+        return;
+
+    for (int level = modeC - 1; level <= modeC + 1; ++level)
+    {
+        struct modeac_link *l = &cold->modeac_links[1 + (level % 3 + 3) % 3];
+        unsigned modeA;
+
+        if (a->modeac_level_filed && abs(level - a->modeac_level) <= 1)
+            continue; // filed under this level already
+
+        if ((modeA = mode_c_to_mode_a(level)))
+            track_modeac_file(a, l, mode_a_to_index(modeA));
+        else
+            track_modeac_unfile(l);
+    }
+
+    a->modeac_level = modeC;
+    a->modeac_level_filed = true;
+}
+
+/* Add a new aircraft to the table and the end of the list.
+ * The table is kept at most half full.
+ */
+static bool track_add_aircraft(struct aircraft *a)
+{
+    struct aircraft_table *t = &lib_state.aircrafts;
+    uint32_t i;
+
+    if ((t->count + 1) * 2 > t->mask + 1 && !track_table_grow(t) && t->count + 1 >= t->mask)
+        return false;
+
+    for (i = track_slot(TRACK_KEY(a->addr), t->mask); t->keys[i]; i = (i + 1) & t->mask)
+        ;
+    t->keys[i] = TRACK_KEY(a->addr);
+    t->aircraft[i] = a;
+    t->count++;
+
+    a->next = NULL;
+    a->prev = t->last;
+    if (t->last)
+        t->last->next = a;
+    else
+        t->first = a;
+    t->last = a;
+
+    // the first visit works out when it is really due
+    track_wheel_insert(a, lib_state.aircraft_wheel.tick + 1);
+    return true;
+}
+
+/* Remove an aircraft from the table and the list, and free it.
+ * Entries after it in its probe run are shifted back so lookups
+ * never need tombstones.
+ */
+static void track_free_aircraft(struct aircraft *a)
+{
+    struct aircraft_table *t = &lib_state.aircrafts;
+    uint32_t i, j;
+
+    track_wheel_unlink(a);
+    for (i = 0; i < 4; ++i)
+        track_modeac_unfile(&a->cold->modeac_links[i]);
+
+    for (i = track_slot(TRACK_KEY(a->addr), t->mask); t->aircraft[i] != a; i = (i + 1) & t->mask)
+        ;
+
+    for (j = (i + 1) & t->mask; t->keys[j]; j = (j + 1) & t->mask)
+    {
+        // can the entry at j move back to the hole at i? Only if its
+        // home slot is not in the (cyclic) range (i, j]
+        uint32_t home = track_slot(t->keys[j], t->mask);
+        if (((j - home) & t->mask) >= ((j - i) & t->mask))
+        {
+            t->keys[i] = t->keys[j];
+            t->aircraft[i] = t->aircraft[j];
+            i = j;
+        }
+    }
+    t->keys[i] = 0;
+    t->aircraft[i] = NULL;
+    t->count--;
+
+    if (a->prev)
+        a->prev->next = a->next;
+    else
+        t->first = a->next;
+    if (a->next)
+        a->next->prev = a->prev;
+    else
+        t->last = a->prev;
+
+    track_release_aircraft(a);
+}
+
+bool track_init()
+{
+    uint32_t size = AIRCRAFTS_INITIAL_SIZE;
+
+    // size the table so the preallocated aircraft fit without growing it
+    while (size / 2 < lib_state.config.aircraft_prealloc && size < (1U << 24))
+        size *= 2;
+
+    memset(&lib_state.aircrafts, 0, sizeof(lib_state.aircrafts));
+    memset(&lib_state.aircraft_wheel, 0, sizeof(lib_state.aircraft_wheel));
+    memset(lib_state.aircraft_probation, 0, sizeof(lib_state.aircraft_probation));
+    lib_state.aircraft_wheel.tick = mstime() / 1000;
+    memset(&match_ac_pass, 0, sizeof(match_ac_pass));
+    memset(modeAC_aircraft, 0, sizeof(modeAC_aircraft));
+    modeAC_active_count = 0;
+    track_next_update = 0;
+    track_min_expire = UINT32_MAX;
+    for (int i = 0; i < VALIDITY_FIELDS; ++i)
+    {
+        if (track_validity_intervals[i].expire < track_min_expire)
+            track_min_expire = track_validity_intervals[i].expire;
+    }
+    if (!pool_init(&lib_state.aircraft_pool, sizeof(struct aircraft), AIRCRAFTS_POOL_SLAB, lib_state.config.aircraft_prealloc) ||
+        !pool_init(&lib_state.aircraft_cold_pool, sizeof(struct aircraft_cold), AIRCRAFTS_POOL_SLAB, lib_state.config.aircraft_prealloc) ||
+        !track_table_alloc(&lib_state.aircrafts, size))
+    {
+        pool_destroy(&lib_state.aircraft_pool);
+        pool_destroy(&lib_state.aircraft_cold_pool);
+        return false;
+    }
+    return true;
+}
+
+void track_cleanup()
+{
+    struct aircraft_table *t = &lib_state.aircrafts;
+
+    pool_destroy(&lib_state.aircraft_pool);
+    pool_destroy(&lib_state.aircraft_cold_pool);
+    free(t->keys);
+    free(t->aircraft);
+    memset(t, 0, sizeof(*t));
+}
+
 /* Should we accept some new data from the given source?
  * If so, update the validity and return 1
  */
 static int accept_data(data_validity *d, datasource_t source, modes_message_t *mm, int reduce_often)
 {
-    if (messageNow() < d->updated)
+    uint32_t now = (uint32_t)messageNow();
+
+    if (d->updated && track_time_before(now, d->updated))
         return 0;
 
-    if (source < d->source && messageNow() < d->stale)
+    if (source < d->source && track_time_before(now, track_data_stale_time(d)))
         return 0;
 
     d->source = source;
-    d->updated = messageNow();
-    d->stale = messageNow() + (d->stale_interval ? d->stale_interval : 60000);
-    d->expires = messageNow() + (d->expire_interval ? d->expire_interval : 70000);
+    d->updated = now ? now : 1;
+    d->stale_cut = d->expire_cut = 0;
 
-    if (messageNow() > d->next_reduce_forward && !mm->sbs_in)
+    // hold off only within 7s of a forwarded CPR message
+    if ((uint32_t)(d->next_reduce_forward - now) > 7000 && !mm->sbs_in)
     {
         // make sure global CPR stays possible even at high interval:
         if (mm->cpr_valid)
         {
-            d->next_reduce_forward = messageNow() + 7000;
+            d->next_reduce_forward = now + 7000;
         }
         mm->reduce_forward = 1;
     }
@@ -130,6 +504,18 @@ static int accept_data(data_validity *d, datasource_t source, modes_message_t *m
     return 1;
 }
 
+/* How much earlier than its field's usual time 'when' is, for the cuts
+ * of combined data.
+ */
+static uint32_t validity_cut(uint32_t usual, uint32_t when)
+{
+    uint32_t cut = usual - when;
+
+    if ((int32_t)cut < 0)
+        return 0;
+    return cut < 0xFFFFFF ? cut : 0xFFFFFF;
+}
+
 /* Given two datasources, produce a third datasource for data combined from them.
  */
 static void combine_validity(data_validity *to, const data_validity *from1, const data_validity *from2)
@@ -146,47 +532,31 @@ static void combine_validity(data_validity *to, const data_validity *from1, cons
         return;
     }
 
-    to->source = (from1->source < from2->source) ? from1->source : from2->source;      // the worse of the two input sources
-    to->updated = (from1->updated > from2->updated) ? from1->updated : from2->updated; // the *later* of the two update times
-    to->stale = (from1->stale < from2->stale) ? from1->stale : from2->stale;           // the earlier of the two stale times
-    to->expires = (from1->expires < from2->expires) ? from1->expires : from2->expires; // the earlier of the two expiry times
+    uint32_t stale1 = track_data_stale_time(from1), stale2 = track_data_stale_time(from2);
+    uint32_t expires1 = track_data_expire_time(from1), expires2 = track_data_expire_time(from2);
+    uint32_t stale = track_time_before(stale1, stale2) ? stale1 : stale2;         // the earlier of the two stale times
+    uint32_t expires = track_time_before(expires1, expires2) ? expires1 : expires2; // the earlier of the two expiry times
+
+    to->source = (from1->source < from2->source) ? from1->source : from2->source;                       // the worse of the two input sources
+    to->updated = track_time_before(from2->updated, from1->updated) ? from1->updated : from2->updated; // the *later* of the two update times
+    to->stale_cut = validity_cut(to->updated + track_validity_intervals[to->field].stale, stale);
+    to->expire_cut = validity_cut(to->updated + track_validity_intervals[to->field].expire, expires);
 }
 
 static int compare_validity(const data_validity *lhs, const data_validity *rhs)
 {
-    if (messageNow() < lhs->stale && lhs->source > rhs->source)
+    uint32_t now = (uint32_t)messageNow();
+
+    if (track_time_before(now, track_data_stale_time(lhs)) && lhs->source > rhs->source)
         return 1;
-    else if (messageNow() < rhs->stale && lhs->source < rhs->source)
+    else if (track_time_before(now, track_data_stale_time(rhs)) && lhs->source < rhs->source)
         return -1;
-    else if (lhs->updated > rhs->updated)
+    else if (lhs->updated == rhs->updated)
+        return 0;
+    else if (!rhs->updated || (lhs->updated && track_time_before(rhs->updated, lhs->updated)))
         return 1;
-    else if (lhs->updated < rhs->updated)
-        return -1;
     else
-        return 0;
-}
-
-/**
- * Calculate bearing of two coordinates
- * @param lat0 Latitude start
- * @param lon0 Longitude start
- * @param lat1 Latitude end
- * @param lon1 Longitude end
- * @return Bearing in 0-360 degree.
- */
-static double get_bearing(double lat0, double lon0, double lat1, double lon1)
-{
-    lat0 = lat0 * M_PI / 180.0;
-    lon0 = lon0 * M_PI / 180.0;
-    lat1 = lat1 * M_PI / 180.0;
-    lon1 = lon1 * M_PI / 180.0;
-
-    double dlon = lon1 - lon0;
-    double x = cos(lat0) * sin(dlon);
-    double y = cos(lat1) * sin(lat0) - sin(lat1) * cos(lat0) * cos(dlon);
-    double b = atan2(x, y);
-    double bearing = 180 / M_PI * b;
-    return bearing + 180;
+        return -1;
 }
 
 /* CPR position updating
@@ -218,15 +588,74 @@ static double greatcircle(double lat0, double lon0, double lat1, double lon1)
     return 6371e3 * acos(sin(lat0) * sin(lat1) + cos(lat0) * cos(lat1) * cos(dlon));
 }
 
+/*
+ * Distance from the receiver, as greatcircle() from the receiver location
+ * but with the receiver's terms set up once by readsb_init().
+ * If 'bearing' is not NULL it receives the bearing from the receiver
+ * in 0-360 degree.
+ */
+static double receiver_range(double lat, double lon, double *bearing)
+{
+    double lat0 = lib_state.receiver.lat;
+    double lat1 = lat * M_PI / 180.0;
+    double lon1 = lon * M_PI / 180.0;
+    double sin_lat1 = sin(lat1);
+    double cos_lat1 = cos(lat1);
+    double dlon = lon1 - lib_state.receiver.lon;
+    double cos_dlon = cos(dlon);
+
+    if (bearing)
+    {
+        double x = lib_state.receiver.cos_lat * sin(dlon);
+        double y = cos_lat1 * lib_state.receiver.sin_lat - sin_lat1 * lib_state.receiver.cos_lat * cos_dlon;
+        *bearing = 180 / M_PI * atan2(x, y) + 180;
+    }
+
+    double dlat = fabs(lat1 - lat0);
+    dlon = fabs(dlon);
+
+    // use haversine for small distances for better numerical stability
+    if (dlat < 0.001 && dlon < 0.001)
+    {
+        double a = sin(dlat / 2) * sin(dlat / 2) + lib_state.receiver.cos_lat * cos_lat1 * sin(dlon / 2) * sin(dlon / 2);
+        return 6371e3 * 2 * atan2(sqrt(a), sqrt(1.0 - a));
+    }
+
+    // spherical law of cosines
+    return 6371e3 * acos(lib_state.receiver.sin_lat * sin_lat1 + lib_state.receiver.cos_lat * cos_lat1 * cos_dlon);
+}
+
+/*
+ * Distance between two nearby points, taking the earth as flat around their
+ * mean latitude (equirectangular approximation). Costs one cos() where
+ * greatcircle() needs six transcendental calls. Below 75 degrees latitude
+ * it stays within 0.02% of greatcircle() up to 100km, far inside the
+ * margins of speed_check().
+ */
+static double flat_distance(double lat0, double lon0, double lat1, double lon1)
+{
+    double dlat = lat1 - lat0;
+    double dlon = lon1 - lon0;
+
+    if (dlon > 180)
+        dlon -= 360;
+    else if (dlon < -180)
+        dlon += 360;
+    dlon *= cos((lat0 + lat1) * M_PI / 360.0);
+
+    return 6371e3 * M_PI / 180.0 * sqrt(dlat * dlat + dlon * dlon);
+}
+
 static uint32_t update_polar_range(double lat, double lon)
 {
     double range = 0;
+    double bearing;
     int valid_latlon = lib_state.bUserFlags & MODES_USER_LATLON_VALID;
 
     if (!valid_latlon)
         return 0;
 
-    range = greatcircle(lib_state.config.latitude, lib_state.config.longitude, lat, lon);
+    range = receiver_range(lat, lon, &bearing);
 
     if ((range <= lib_state.config.max_range || lib_state.config.max_range == 0) && range > lib_state.stats_current.longest_distance)
     {
@@ -234,7 +663,7 @@ static uint32_t update_polar_range(double lat, double lon)
     }
 
     // Round bearing to polarplot resolution.
-    int bucket = round(get_bearing(lib_state.config.latitude, lib_state.config.longitude, lat, lon) / POLAR_RANGE_RESOLUTION);
+    int bucket = round(bearing / POLAR_RANGE_RESOLUTION);
     // Catch and avoid out of bounds writes
     if (bucket >= POLAR_RANGE_BUCKETS)
     {
@@ -272,13 +701,13 @@ static int speed_check(struct aircraft *a, double lat, double lon, int surface)
         // add 2 knots for every second we haven't known the speed
         speed = speed + (2 * track_data_age(&a->gs_valid) / 1000.0);
     }
-    else if (track_data_valid(&a->tas_valid))
+    else if (track_data_valid(&a->cold->tas_valid))
     {
-        speed = a->tas * 4 / 3;
+        speed = a->cold->tas * 4 / 3;
     }
-    else if (track_data_valid(&a->ias_valid))
+    else if (track_data_valid(&a->cold->ias_valid))
     {
-        speed = a->ias * 2;
+        speed = a->cold->ias * 2;
     }
     else
     {
@@ -308,7 +737,7 @@ static int speed_check(struct aircraft *a, double lat, double lon, int surface)
     range = (surface ? 0.1e3 : 0.5e3) + ((elapsed + 1000.0) / 1000.0) * (speed * 1852.0 / 3600.0);
 
     // find actual distance
-    distance = greatcircle(a->lat, a->lon, lat, lon);
+    distance = flat_distance(a->lat, a->lon, lat, lon);
 
     inrange = (distance <= range);
 
@@ -371,7 +800,7 @@ static int do_global_cpr(struct aircraft *a, modes_message_t *mm, double *lat, d
     // check max range
     if (lib_state.config.max_range > 0 && (lib_state.bUserFlags & MODES_USER_LATLON_VALID))
     {
-        double range = greatcircle(lib_state.config.latitude, lib_state.config.longitude, *lat, *lon);
+        double range = receiver_range(*lat, *lon, NULL);
         if (range > lib_state.config.max_range)
         {
             lib_state.stats_current.cpr_global_range_checks++;
@@ -415,7 +844,7 @@ static int do_local_cpr(struct aircraft *a, modes_message_t *mm, double *lat, do
         *rc = a->cpr_even_rc;
     }
 
-    if (messageNow() - a->position_valid.updated < (10 * 60 * 1000))
+    if (a->position_valid.updated && (uint32_t)messageNow() - a->position_valid.updated < (10 * 60 * 1000))
     {
         reflat = a->lat;
         reflon = a->lon;
@@ -488,7 +917,7 @@ static int do_local_cpr(struct aircraft *a, modes_message_t *mm, double *lat, do
     // check range limit
     if (range_limit > 0)
     {
-        double range = greatcircle(reflat, reflon, *lat, *lon);
+        double range = (relative_to == 2) ? receiver_range(*lat, *lon, NULL) : greatcircle(reflat, reflon, *lat, *lon);
         if (range > range_limit)
         {
             lib_state.stats_current.cpr_local_range_checks++;
@@ -506,9 +935,9 @@ static int do_local_cpr(struct aircraft *a, modes_message_t *mm, double *lat, do
     return relative_to;
 }
 
-static uint64_t time_between(uint64_t t1, uint64_t t2)
+static uint32_t time_between(uint32_t t1, uint32_t t2)
 {
-    if (t1 >= t2)
+    if (!track_time_before(t1, t2))
         return t1 - t2;
     else
         return t2 - t1;
@@ -551,6 +980,7 @@ static void update_position(struct aircraft *a, modes_message_t *mm)
     {
 
         location_result = do_global_cpr(a, mm, &new_lat, &new_lon, &new_nic, &new_rc);
+        READSB_TRACE3(cpr_global, a->addr, surface, location_result);
 
         if (location_result == -2)
         {
@@ -616,6 +1046,7 @@ static void update_position(struct aircraft *a, modes_message_t *mm)
     if (location_result == -1)
     {
         location_result = do_local_cpr(a, mm, &new_lat, &new_lon, &new_nic, &new_rc);
+        READSB_TRACE3(cpr_local, a->addr, surface, location_result);
 
         if (location_result >= 0 && accept_data(&a->position_valid, mm->source, mm, 1))
         {
@@ -656,12 +1087,11 @@ static void update_position(struct aircraft *a, modes_message_t *mm)
         a->nic = new_nic;
         a->rc = new_rc;
 
-        double dip, ti, gv;
         // Update magnetic declination whenever position changes
         if (track_data_valid(&a->altitude_geom_valid))
         {
             // Altitude given in feet but required to be in kilometer above WGS84 ellipsoid.
-            geomag_calc(a->alt_geom * 0.0003048, a->lat, a->lon, -1.0, &a->declination, &dip, &ti, &gv);
+            geomag_declination(a->alt_geom * 0.0003048, a->lat, a->lon, &a->declination);
         }
 
         a->distance = false;
@@ -1096,37 +1526,208 @@ static int altitude_to_feet(int raw, altitude_unit_t unit)
     }
 }
 
+/* Take the held first frame of an address out of probation. If it is
+ * still fresh and decodes again, it is returned in 'first' and 1 is
+ * returned; -1 if it was held but can't be replayed; 0 if it wasn't held.
+ */
+static int track_probation_take(modes_message_t *mm, modes_message_t *first)
+{
+    uint32_t key = TRACK_KEY(mm->addr);
+    uint32_t now = (uint32_t)mm->sysTimestampMsg;
+    struct probation_entry *bucket = lib_state.aircraft_probation[track_slot(key, AIRCRAFTS_PROBATION_BUCKETS - 1)];
+
+    for (int w = 0; w < AIRCRAFTS_PROBATION_WAYS; ++w)
+    {
+        struct probation_entry *e = &bucket[w];
+
+        if (e->key != key)
+            continue;
+
+        e->key = 0;
+        if (track_time_before(e->seen + TRACK_AIRCRAFT_ONEHIT_TTL, now))
+        {
+            // the address went quiet for too long: a new one-hit address
+            lib_state.stats_current.single_message_aircraft++;
+            return 0;
+        }
+
+        memset(first, 0, sizeof(*first));
+        if (decode_modes_message(first, e->frame, NULL) < 0 || first->addr != mm->addr)
+            return -1;
+        first->sysTimestampMsg = mm->sysTimestampMsg - (uint32_t)(now - e->seen);
+        first->signalLevel = e->signal / 65535.0;
+        return 1;
+    }
+    return 0;
+}
+
+/* Hold the first frame of an unknown address, evicting the oldest held
+ * frame of its bucket if needed. Returns false if the message can't be
+ * replayed from its frame and the aircraft should be created at once.
+ */
+static bool track_probation_add(modes_message_t *mm)
+{
+    uint32_t key = TRACK_KEY(mm->addr);
+    struct probation_entry *bucket = lib_state.aircraft_probation[track_slot(key, AIRCRAFTS_PROBATION_BUCKETS - 1)];
+    struct probation_entry *e = NULL;
+
+    if (mm->remote || mm->sbs_in || !mm->msgbits)
+        return false;
+
+    for (int w = 0; w < AIRCRAFTS_PROBATION_WAYS; ++w)
+    {
+        if (!bucket[w].key)
+        {
+            e = &bucket[w];
+            break;
+        }
+        if (!e || track_time_before(bucket[w].seen, e->seen))
+            e = &bucket[w];
+    }
+
+    if (e->key)
+        lib_state.stats_current.single_message_aircraft++;
+    e->key = key;
+    e->seen = (uint32_t)mm->sysTimestampMsg;
+    memcpy(e->frame, mm->verbatim, MODES_LONG_MSG_BYTES);
+    e->signal = (uint16_t)(mm->signalLevel * 65535.0 + 0.5);
+    return true;
+}
+
+static struct aircraft *track_update_aircraft(struct aircraft *a, modes_message_t *mm);
+
+/* Should aircraft 'a' be evicted rather than 'b'? */
+static inline bool track_evict_before(const struct aircraft *a, const struct aircraft *b)
+{
+    bool few_a = a->messages < TRACK_EVICT_FEW_MESSAGES;
+    bool few_b = b->messages < TRACK_EVICT_FEW_MESSAGES;
+
+    if (few_a != few_b)
+        return few_a;
+    return a->seen_ms < b->seen_ms;
+}
+
+/* Make room for a new aircraft. Rather than keeping the aircraft in
+ * order of use, which would cost every message a list update, a few are
+ * picked at random from the table and the one with few messages that was
+ * seen longest ago is evicted.
+ */
+static void track_evict_aircraft()
+{
+    static uint32_t seed = 2463534242U;
+    struct aircraft_table *t = &lib_state.aircrafts;
+    struct aircraft *victim = NULL;
+
+    if (!t->count)
+        return;
+
+    for (int n = 0; n < TRACK_EVICT_SAMPLES; ++n)
+    {
+        uint32_t i;
+
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        for (i = seed & t->mask; !t->keys[i]; i = (i + 1) & t->mask)
+            ;
+        if (!victim || track_evict_before(t->aircraft[i], victim))
+            victim = t->aircraft[i];
+    }
+
+    if (!(victim->addr & MODES_NON_ICAO_ADDRESS))
+        icao_filter_set_aircraft(victim->addr, NULL);
+    track_free_aircraft(victim);
+    lib_state.stats_current.aircraft_evicted++;
+}
+
+/* Handle a message from an address that is not tracked: hold it if it
+ * is the first one, otherwise create the aircraft and replay the held
+ * frame. Returns the new aircraft, or NULL if there is none (yet).
+ */
+static struct aircraft *track_admit_aircraft(modes_message_t *mm)
+{
+    modes_message_t first;
+    struct aircraft *a;
+    int held = track_probation_take(mm, &first);
+
+    if (!held)
+    {
+        lib_state.stats_current.unique_aircraft++;
+        if (track_probation_add(mm))
+            return NULL;
+    }
+
+    if (lib_state.config.max_aircraft && lib_state.aircrafts.count >= lib_state.config.max_aircraft)
+        track_evict_aircraft();
+
+    a = track_create_aircraft(held > 0 ? &first : mm);
+    if (!a || !track_add_aircraft(a))
+    {
+        fprintf(stderr, "libreadsb: Out of memory tracking a new aircraft\n");
+        if (a)
+            track_release_aircraft(a);
+        return NULL;
+    }
+
+    if (held > 0)
+        track_update_aircraft(a, &first);
+    return a;
+}
+
 /* Receive new messages and update tracked aircraft state
  */
 struct aircraft *track_update_from_message(modes_message_t *mm)
 {
     struct aircraft *a;
-    unsigned int cpr_new = 0;
+
+    READSB_TRACE2(track_entry, mm->addr, mm->msgtype);
 
     if (mm->msgtype == 32)
     {
         // Mode A/C, just count it (we ignore SPI)
-        modeAC_count[mode_a_to_index(mm->squawk)]++;
+        unsigned i = mode_a_to_index(mm->squawk);
+        if (!modeAC_count[i]++)
+            modeAC_active[modeAC_active_count++] = i;
+        READSB_TRACE2(track_exit, mm->addr, 0);
         return NULL;
     }
 
     if (mm->addr == 0)
     {
         // junk address, don't track it
+        READSB_TRACE2(track_exit, mm->addr, 0);
         return NULL;
     }
 
-    _messageNow = mm->sysTimestampMsg;
+    // Lookup our aircraft or create a new one, unless scoring already found it
+    a = mm->aircraft;
+    if (!a || a->addr != mm->addr)
+    {
+        a = track_find_aircraft(mm->addr);
+        if (!a && !(a = track_admit_aircraft(mm)))
+        {
+            READSB_TRACE2(track_exit, mm->addr, 0);
+            return NULL;
+        }
 
-    // Lookup our aircraft or create a new one
-    a = track_find_aircraft(mm->addr);
-    if (!a)
-    {                                                                // If it's a currently unknown aircraft....
-        a = track_create_aircraft(mm);                               // ., create a new record for it,
-        a->next = lib_state.aircrafts[mm->addr % AIRCRAFTS_BUCKETS]; // .. and put it at the head of the list
-        lib_state.aircrafts[mm->addr % AIRCRAFTS_BUCKETS] = a;
+        // let the next message from it skip the lookup
+        if (!(mm->addr & MODES_NON_ICAO_ADDRESS))
+            icao_filter_set_aircraft(mm->addr, a);
     }
 
+    return track_update_aircraft(a, mm);
+}
+
+/* Update a tracked aircraft from a message
+ */
+static struct aircraft *track_update_aircraft(struct aircraft *a, modes_message_t *mm)
+{
+    unsigned int cpr_new = 0;
+
+    _messageNow = mm->sysTimestampMsg;
+
     if (mm->signalLevel > 0)
     {
         a->signalLevel[a->signalNext] = mm->signalLevel;
@@ -1267,6 +1868,8 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
                         a->addr, a->altitude_baro_reliable, a->altitude_baro, alt, min_fpm/1000.0, max_fpm/1000.0, fpm/1000.0);
                 }*/
                 a->alt_baro = alt;
+                if (lib_state.config.mode_ac)
+                    track_modeac_file_altitude(a);
             }
         }
         else
@@ -1285,6 +1888,11 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
 
     if (mm->squawk_valid && accept_data(&a->squawk_valid, mm->source, mm, 0))
     {
+        if (lib_state.config.mode_ac && (mm->squawk != a->squawk || !a->modeac_squawk_filed))
+        {
+            track_modeac_file(a, &a->cold->modeac_links[0], mode_a_to_index(mm->squawk));
+            a->modeac_squawk_filed = true;
+        }
         if (mm->squawk != a->squawk)
         {
             a->modeA_hit = 0;
@@ -1311,16 +1919,16 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
                     break;
             }
 
-            if (squawk_emergency != EMERGENCY_NONE && accept_data(&a->emergency_valid, mm->source, mm, 0)) {
-                a->emergency = squawk_emergency;
+            if (squawk_emergency != EMERGENCY_NONE && accept_data(&a->cold->emergency_valid, mm->source, mm, 0)) {
+                a->cold->emergency = squawk_emergency;
             }
         }
 #endif
     }
 
-    if (mm->emergency_valid && accept_data(&a->emergency_valid, mm->source, mm, 0))
+    if (mm->emergency_valid && accept_data(&a->cold->emergency_valid, mm->source, mm, 0))
     {
-        a->emergency = mm->emergency;
+        a->cold->emergency = mm->emergency;
     }
 
     if (mm->altitude_geom_valid && accept_data(&a->altitude_geom_valid, mm->source, mm, 1))
@@ -1359,14 +1967,14 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
         }
     }
 
-    if (mm->track_rate_valid && accept_data(&a->track_rate_valid, mm->source, mm, 1))
+    if (mm->track_rate_valid && accept_data(&a->cold->track_rate_valid, mm->source, mm, 1))
     {
-        a->track_rate = mm->track_rate;
+        a->cold->track_rate = mm->track_rate;
     }
 
-    if (mm->roll_valid && accept_data(&a->roll_valid, mm->source, mm, 1))
+    if (mm->roll_valid && accept_data(&a->cold->roll_valid, mm->source, mm, 1))
     {
-        a->roll = mm->roll;
+        a->cold->roll = mm->roll;
     }
 
     if (mm->gs_valid)
@@ -1378,19 +1986,19 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
         }
     }
 
-    if (mm->ias_valid && accept_data(&a->ias_valid, mm->source, mm, 0))
+    if (mm->ias_valid && accept_data(&a->cold->ias_valid, mm->source, mm, 0))
     {
-        a->ias = mm->ias;
+        a->cold->ias = mm->ias;
     }
 
-    if (mm->tas_valid && accept_data(&a->tas_valid, mm->source, mm, 0))
+    if (mm->tas_valid && accept_data(&a->cold->tas_valid, mm->source, mm, 0))
     {
-        a->tas = mm->tas;
+        a->cold->tas = mm->tas;
     }
 
-    if (mm->mach_valid && accept_data(&a->mach_valid, mm->source, mm, 0))
+    if (mm->mach_valid && accept_data(&a->cold->mach_valid, mm->source, mm, 0))
     {
-        a->mach = mm->mach;
+        a->cold->mach = mm->mach;
     }
 
     if (mm->baro_rate_valid && accept_data(&a->baro_rate_valid, mm->source, mm, 1))
@@ -1422,67 +2030,67 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
         memcpy(a->flight_id, mm->callsign, sizeof(a->flight_id));
     }
 
-    if (mm->nav.mcp_altitude_valid && accept_data(&a->nav_altitude_mcp_valid, mm->source, mm, 0))
+    if (mm->nav.mcp_altitude_valid && accept_data(&a->cold->nav_altitude_mcp_valid, mm->source, mm, 0))
     {
-        a->nav_altitude_mcp = mm->nav.mcp_altitude;
+        a->cold->nav_altitude_mcp = mm->nav.mcp_altitude;
     }
 
-    if (mm->nav.fms_altitude_valid && accept_data(&a->nav_altitude_fms_valid, mm->source, mm, 0))
+    if (mm->nav.fms_altitude_valid && accept_data(&a->cold->nav_altitude_fms_valid, mm->source, mm, 0))
     {
-        a->nav_altitude_fms = mm->nav.fms_altitude;
+        a->cold->nav_altitude_fms = mm->nav.fms_altitude;
     }
 
-    if (mm->nav.altitude_source != NAV_ALT_INVALID && accept_data(&a->nav_altitude_src_valid, mm->source, mm, 0))
+    if (mm->nav.altitude_source != NAV_ALT_INVALID && accept_data(&a->cold->nav_altitude_src_valid, mm->source, mm, 0))
     {
-        a->nav_altitude_src = mm->nav.altitude_source;
+        a->cold->nav_altitude_src = mm->nav.altitude_source;
     }
 
-    if (mm->nav.heading_valid && accept_data(&a->nav_heading_valid, mm->source, mm, 0))
+    if (mm->nav.heading_valid && accept_data(&a->cold->nav_heading_valid, mm->source, mm, 0))
     {
-        a->nav_heading = mm->nav.heading;
+        a->cold->nav_heading = mm->nav.heading;
     }
 
-    if (mm->nav.modes_valid && accept_data(&a->nav_modes_valid, mm->source, mm, 0))
+    if (mm->nav.modes_valid && accept_data(&a->cold->nav_modes_valid, mm->source, mm, 0))
     {
         if (mm->nav.modes & NAV_MODE_AUTOPILOT)
         {
-            a->nav_modes.autopilot = true;
+            a->cold->nav_modes.autopilot = true;
         }
         if (mm->nav.modes & NAV_MODE_VNAV)
         {
-            a->nav_modes.vnav = true;
+            a->cold->nav_modes.vnav = true;
         }
         if (mm->nav.modes & NAV_MODE_ALT_HOLD)
         {
-            a->nav_modes.althold = true;
+            a->cold->nav_modes.althold = true;
         }
         if (mm->nav.modes & NAV_MODE_APPROACH)
         {
-            a->nav_modes.approach = true;
+            a->cold->nav_modes.approach = true;
         }
         if (mm->nav.modes & NAV_MODE_LNAV)
         {
-            a->nav_modes.lnav = true;
+            a->cold->nav_modes.lnav = true;
         }
         if (mm->nav.modes & NAV_MODE_TCAS)
         {
-            a->nav_modes.tcas = true;
+            a->cold->nav_modes.tcas = true;
         }
     }
 
-    if (mm->nav.qnh_valid && accept_data(&a->nav_qnh_valid, mm->source, mm, 0))
+    if (mm->nav.qnh_valid && accept_data(&a->cold->nav_qnh_valid, mm->source, mm, 0))
     {
-        a->nav_qnh = mm->nav.qnh;
+        a->cold->nav_qnh = mm->nav.qnh;
     }
 
-    if (mm->alert_valid && accept_data(&a->alert_valid, mm->source, mm, 0))
+    if (mm->alert_valid && accept_data(&a->cold->alert_valid, mm->source, mm, 0))
     {
-        a->alert = mm->alert;
+        a->cold->alert = mm->alert;
     }
 
-    if (mm->spi_valid && accept_data(&a->spi_valid, mm->source, mm, 0))
+    if (mm->spi_valid && accept_data(&a->cold->spi_valid, mm->source, mm, 0))
     {
-        a->spi = mm->spi;
+        a->cold->spi = mm->spi;
     }
 
     // CPR, even
@@ -1505,9 +2113,9 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
         cpr_new = 1;
     }
 
-    if (mm->accuracy.sda_valid && accept_data(&a->sda_valid, mm->source, mm, 0))
+    if (mm->accuracy.sda_valid && accept_data(&a->cold->sda_valid, mm->source, mm, 0))
     {
-        a->sda = mm->accuracy.sda;
+        a->cold->sda = mm->accuracy.sda;
     }
 
     if (mm->accuracy.nic_a_valid && accept_data(&a->nic_a_valid, mm->source, mm, 0))
@@ -1520,38 +2128,38 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
         a->nic_c = mm->accuracy.nic_c;
     }
 
-    if (mm->accuracy.nic_baro_valid && accept_data(&a->nic_baro_valid, mm->source, mm, 0))
+    if (mm->accuracy.nic_baro_valid && accept_data(&a->cold->nic_baro_valid, mm->source, mm, 0))
     {
-        a->nic_baro = mm->accuracy.nic_baro;
+        a->cold->nic_baro = mm->accuracy.nic_baro;
     }
 
-    if (mm->accuracy.nac_p_valid && accept_data(&a->nac_p_valid, mm->source, mm, 0))
+    if (mm->accuracy.nac_p_valid && accept_data(&a->cold->nac_p_valid, mm->source, mm, 0))
     {
-        a->nac_p = mm->accuracy.nac_p;
+        a->cold->nac_p = mm->accuracy.nac_p;
     }
 
-    if (mm->accuracy.nac_v_valid && accept_data(&a->nac_v_valid, mm->source, mm, 0))
+    if (mm->accuracy.nac_v_valid && accept_data(&a->cold->nac_v_valid, mm->source, mm, 0))
     {
-        a->nac_v = mm->accuracy.nac_v;
+        a->cold->nac_v = mm->accuracy.nac_v;
     }
 
-    if (mm->accuracy.sil_type != SIL_INVALID && accept_data(&a->sil_valid, mm->source, mm, 0))
+    if (mm->accuracy.sil_type != SIL_INVALID && accept_data(&a->cold->sil_valid, mm->source, mm, 0))
     {
-        a->sil = mm->accuracy.sil;
-        if (a->sil_type == SIL_INVALID || mm->accuracy.sil_type != SIL_UNKNOWN)
+        a->cold->sil = mm->accuracy.sil;
+        if (a->cold->sil_type == SIL_INVALID || mm->accuracy.sil_type != SIL_UNKNOWN)
         {
-            a->sil_type = mm->accuracy.sil_type;
+            a->cold->sil_type = mm->accuracy.sil_type;
         }
     }
 
-    if (mm->accuracy.gva_valid && accept_data(&a->gva_valid, mm->source, mm, 0))
+    if (mm->accuracy.gva_valid && accept_data(&a->cold->gva_valid, mm->source, mm, 0))
     {
-        a->gva = mm->accuracy.gva;
+        a->cold->gva = mm->accuracy.gva;
     }
 
-    if (mm->accuracy.sda_valid && accept_data(&a->sda_valid, mm->source, mm, 0))
+    if (mm->accuracy.sda_valid && accept_data(&a->cold->sda_valid, mm->source, mm, 0))
     {
-        a->sda = mm->accuracy.sda;
+        a->cold->sda = mm->accuracy.sda;
     }
 
     // Now handle derived data
@@ -1590,89 +2198,76 @@ struct aircraft *track_update_from_message(modes_message_t *mm)
         mm->reduce_forward = 1;
     }
 
+    track_wheel_reschedule(a);
+
+    READSB_TRACE2(track_exit, a->addr, a->messages);
     return (a);
 }
 
 /* Periodic updates of tracking state
- * Periodically match up mode A/C results with mode S results
+ * Periodically match up mode A/C results with mode S results.
+ * A pass goes through the Mode A/C codes heard recently and, for the live
+ * ones, the aircraft filed under them, so it costs time in proportion to
+ * the codes in use rather than to the aircraft tracked. It may be spread
+ * over several calls of at most 'budget' items each (a code's aircraft
+ * are always handled together). Returns the number of items handled.
  */
-static void track_match_ac(uint64_t now)
+static unsigned track_match_ac(uint64_t now, unsigned budget)
 {
-    // clear match flags
-    for (unsigned i = 0; i < 4096; ++i)
-    {
-        modeAC_match[i] = 0;
-    }
+    unsigned work = 0;
 
-    // scan aircraft list, look for matches
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++)
+    while (match_ac_pass.phase == MATCH_AC_CODES && work < budget)
     {
-        for (struct aircraft *a = lib_state.aircrafts[j]; a; a = a->next)
+        if (!match_ac_pass.index)
         {
-            if ((now - a->seen_ms) > 5000)
-            {
-                continue;
-            }
+            match_ac_pass.phase = MATCH_AC_IDLE;
+            break;
+        }
 
-            // match on Mode A
-            if (track_data_valid(&a->squawk_valid))
+        // going down, so a code cleared out below can be replaced by the last one
+        unsigned pos = --match_ac_pass.index;
+        unsigned i = modeAC_active[pos];
+        work++;
+
+        modeAC_match[i] = 0;
+        if ((modeAC_count[i] - modeAC_lastcount[i]) < TRACK_MODEAC_MIN_MESSAGES)
+        {
+            if (++modeAC_age[i] > 15)
             {
-                unsigned i = mode_a_to_index(a->squawk);
-                if ((modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES)
-                {
-                    a->modeA_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-                }
+                // not heard from for a while, clear it out
+                modeAC_lastcount[i] = modeAC_count[i] = modeAC_age[i] = 0;
+                modeAC_active[pos] = modeAC_active[--modeAC_active_count];
+                continue;
             }
-
-            // match on Mode C (+/- 100ft)
-            if (track_data_valid(&a->altitude_baro_valid))
+        }
+        else
+        {
+            // look for matches on Mode A, or Mode C (+/- 100ft)
+            for (struct modeac_link *l = modeAC_aircraft[i]; l; l = l->next)
             {
-                int modeC = (a->alt_baro + 49) / 100;
+                struct aircraft *a = l->aircraft;
+                work++;
 
-                unsigned modeA = mode_c_to_mode_a(modeC);
-                unsigned i = mode_a_to_index(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES)
+                if ((now - a->seen_ms) > 5000)
                 {
-                    a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
+                    continue;
                 }
 
-                modeA = mode_c_to_mode_a(modeC + 1);
-                i = mode_a_to_index(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES)
+                if (l == &a->cold->modeac_links[0])
                 {
-                    a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
+                    if (!track_data_valid(&a->squawk_valid))
+                        continue;
+                    a->modeA_hit = 1;
                 }
-
-                modeA = mode_c_to_mode_a(modeC - 1);
-                i = mode_a_to_index(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES)
+                else
                 {
+                    if (!track_data_valid(&a->altitude_baro_valid))
+                        continue;
                     a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
                 }
+                modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
             }
-        }
-    }
 
-    // reset counts for next time
-    for (unsigned i = 0; i < 4096; ++i)
-    {
-        if (!modeAC_count[i])
-            continue;
-
-        if ((modeAC_count[i] - modeAC_lastcount[i]) < TRACK_MODEAC_MIN_MESSAGES)
-        {
-            if (++modeAC_age[i] > 15)
-            {
-                // not heard from for a while, clear it out
-                modeAC_lastcount[i] = modeAC_count[i] = modeAC_age[i] = 0;
-            }
-        }
-        else
-        {
             // this one is live
             // set a high initial age for matches, so they age out rapidly
             // and don't show up on the interactive display when the matching
@@ -1689,123 +2284,244 @@ static void track_match_ac(uint64_t now)
 
         modeAC_lastcount[i] = modeAC_count[i];
     }
+
+    return work;
+}
+
+/* Start a Mode A/C matching pass, unless the last one is still going */
+static void track_match_ac_start()
+{
+    if (match_ac_pass.phase != MATCH_AC_IDLE)
+        return;
+
+    match_ac_pass.phase = MATCH_AC_CODES;
+    match_ac_pass.index = modeAC_active_count;
 }
 
 /* If we don't receive new nessages within TRACK_AIRCRAFT_TTL
- * we remove the aircraft from the list.
+ * we remove the aircraft from the list. Otherwise invalidate its
+ * expired data and schedule the next visit for when anything else
+ * may expire.
  */
-static void track_remove_stale_aircraft(uint64_t now)
+static void track_visit_aircraft(struct aircraft *a, uint64_t now)
 {
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++)
+    uint32_t next;
+    uint64_t due;
+
+    if ((now - a->seen_ms) > TRACK_AIRCRAFT_TTL ||
+        (a->messages == 1 && (now - a->seen_ms) > TRACK_AIRCRAFT_ONEHIT_TTL))
     {
-        struct aircraft *a = lib_state.aircrafts[j];
-        struct aircraft *prev = NULL;
+        // Count aircraft where we saw only one message before reaping them.
+        // These are likely to be due to messages with bad addresses.
+        if (a->messages == 1)
+            lib_state.stats_current.single_message_aircraft++;
 
-        while (a)
-        {
-            if ((now - a->seen_ms) > TRACK_AIRCRAFT_TTL ||
-                (a->messages == 1 && (now - a->seen_ms) > TRACK_AIRCRAFT_ONEHIT_TTL))
-            {
-                // Count aircraft where we saw only one message before reaping them.
-                // These are likely to be due to messages with bad addresses.
-                if (a->messages == 1)
-                    lib_state.stats_current.single_message_aircraft++;
-
-                // Remove the element from the linked list, with care
-                // if we are removing the first element
-                if (!prev)
-                {
-                    lib_state.aircrafts[j] = a->next;
-                    free(a);
-                    a = lib_state.aircrafts[j];
-                }
-                else
-                {
-                    prev->next = a->next;
-                    free(a);
-                    a = prev->next;
-                }
-            }
-            else
-            {
+        if (!(a->addr & MODES_NON_ICAO_ADDRESS))
+            icao_filter_set_aircraft(a->addr, NULL);
+
+        track_free_aircraft(a);
+        return;
+    }
 
-#define EXPIRE(_f)                                                                  \
-    do                                                                              \
-    {                                                                               \
-        if (a->_f##_valid.source != SOURCE_INVALID && now >= a->_f##_valid.expires) \
-        {                                                                           \
-            a->_f##_valid.source = SOURCE_INVALID;                                  \
-        }                                                                           \
+    next = (uint32_t)(a->seen_ms + (a->messages == 1 ? TRACK_AIRCRAFT_ONEHIT_TTL : TRACK_AIRCRAFT_TTL) + 1);
+
+#define EXPIRE(_f)                                                     \
+    do                                                                 \
+    {                                                                  \
+        if (a->_f##_valid.source != SOURCE_INVALID)                    \
+        {                                                              \
+            uint32_t expires = track_data_expire_time(&a->_f##_valid); \
+            if (!track_time_before((uint32_t)now, expires))            \
+                a->_f##_valid.source = SOURCE_INVALID;                 \
+            else if (track_time_before(expires, next))                 \
+                next = expires;                                        \
+        }                                                              \
     } while (0)
-                EXPIRE(callsign);
-                EXPIRE(altitude_baro);
-                EXPIRE(altitude_geom);
-                EXPIRE(geom_delta);
-                EXPIRE(gs);
-                EXPIRE(ias);
-                EXPIRE(tas);
-                EXPIRE(mach);
-                EXPIRE(track);
-                EXPIRE(track_rate);
-                EXPIRE(roll);
-                EXPIRE(mag_heading);
-                EXPIRE(true_heading);
-                EXPIRE(baro_rate);
-                EXPIRE(geom_rate);
-                EXPIRE(squawk);
-                EXPIRE(airground);
-                EXPIRE(nav_qnh);
-                EXPIRE(nav_altitude_mcp);
-                EXPIRE(nav_altitude_fms);
-                EXPIRE(nav_altitude_src);
-                EXPIRE(nav_heading);
-                EXPIRE(nav_modes);
-                EXPIRE(cpr_odd);
-                EXPIRE(cpr_even);
-                EXPIRE(position);
-                EXPIRE(nic_a);
-                EXPIRE(nic_c);
-                EXPIRE(nic_baro);
-                EXPIRE(nac_p);
-                EXPIRE(sil);
-                EXPIRE(gva);
-                EXPIRE(sda);
+    EXPIRE(callsign);
+    EXPIRE(altitude_baro);
+    EXPIRE(altitude_geom);
+    EXPIRE(geom_delta);
+    EXPIRE(gs);
+    EXPIRE(cold->ias);
+    EXPIRE(cold->tas);
+    EXPIRE(cold->mach);
+    EXPIRE(track);
+    EXPIRE(cold->track_rate);
+    EXPIRE(cold->roll);
+    EXPIRE(mag_heading);
+    EXPIRE(true_heading);
+    EXPIRE(baro_rate);
+    EXPIRE(geom_rate);
+    EXPIRE(squawk);
+    EXPIRE(airground);
+    EXPIRE(cold->nav_qnh);
+    EXPIRE(cold->nav_altitude_mcp);
+    EXPIRE(cold->nav_altitude_fms);
+    EXPIRE(cold->nav_altitude_src);
+    EXPIRE(cold->nav_heading);
+    EXPIRE(cold->nav_modes);
+    EXPIRE(cpr_odd);
+    EXPIRE(cpr_even);
+    EXPIRE(position);
+    EXPIRE(nic_a);
+    EXPIRE(nic_c);
+    EXPIRE(cold->nic_baro);
+    EXPIRE(cold->nac_p);
+    EXPIRE(cold->nac_v);
+    EXPIRE(cold->sil);
+    EXPIRE(cold->gva);
+    EXPIRE(cold->sda);
+    EXPIRE(cold->emergency);
+    EXPIRE(cold->alert);
+    EXPIRE(cold->spi);
 #undef EXPIRE
 
-                // reset position reliability when the position has expired
-                if (a->position_valid.source == SOURCE_INVALID)
-                {
-                    a->pos_reliable_odd = 0;
-                    a->pos_reliable_even = 0;
-                }
+    // reset position reliability when the position has expired
+    if (a->position_valid.source == SOURCE_INVALID)
+    {
+        a->pos_reliable_odd = 0;
+        a->pos_reliable_even = 0;
+    }
 
-                if (a->altitude_baro_valid.source == SOURCE_INVALID)
-                    a->altitude_baro_reliable = 0;
+    if (a->altitude_baro_valid.source == SOURCE_INVALID)
+        a->altitude_baro_reliable = 0;
+
+    due = (now + (uint32_t)(next - (uint32_t)now)) / 1000;
+    if (due <= lib_state.aircraft_wheel.tick)
+        due = lib_state.aircraft_wheel.tick + 1;
+    track_wheel_insert(a, due);
+}
+
+/* Take the slot of the given wheel level at the current tick as the
+ * pending list, if that level starts a slot at this tick.
+ */
+static void track_wheel_take(int level)
+{
+    struct aircraft_wheel *w = &lib_state.aircraft_wheel;
+    struct aircraft **slot;
 
-                prev = a;
-                a = a->next;
+    w->level = level;
+    if (level && (w->tick & ((1ULL << (AIRCRAFTS_WHEEL_BITS * level)) - 1)))
+        return;
+
+    slot = &w->slots[level][(w->tick >> (AIRCRAFTS_WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    w->pending = *slot;
+    *slot = NULL;
+    if (w->pending)
+        w->pending->wheel_pprev = &w->pending;
+}
+
+/* Visit the aircraft whose timer wheel slots have come up, one second
+ * at a time, cascading the coarser levels down as their slots start.
+ * At most 'budget' aircraft are cascaded or visited; the rest are left
+ * pending for the next call. Returns the number handled.
+ */
+static unsigned track_remove_stale_aircraft(uint64_t now, unsigned budget)
+{
+    struct aircraft_wheel *w = &lib_state.aircraft_wheel;
+    uint64_t target = now / 1000;
+    struct aircraft *a, *next;
+    unsigned work = 0;
+
+    while (work < budget)
+    {
+        if ((a = w->pending))
+        {
+            track_wheel_unlink(a);
+            if (w->level)
+                track_wheel_insert(a, a->wheel_due);
+            else
+                track_visit_aircraft(a, now);
+            work++;
+        }
+        else if (w->level)
+        {
+            track_wheel_take(w->level - 1);
+        }
+        else if (w->tick >= target)
+        {
+            break;
+        }
+        else if (target > w->tick + WHEEL_SPAN)
+        {
+            // too far behind to step through the wheel: visit everything once
+            w->tick = target;
+            for (a = lib_state.aircrafts.first; a; a = next)
+            {
+                next = a->next;
+                track_wheel_unlink(a);
+                track_visit_aircraft(a, now);
+                work++;
             }
         }
+        else
+        {
+            w->tick++;
+            track_wheel_take(AIRCRAFTS_WHEEL_LEVELS - 1);
+        }
     }
+
+    return work;
 }
 
 //
 // Entry point for periodic updates
 //
 
+static void track_pool_stats()
+{
+    lib_state.stats_current.aircraft_pool_used = lib_state.aircraft_pool.used;
+    lib_state.stats_current.aircraft_pool_allocated = lib_state.aircraft_pool.allocated;
+    lib_state.stats_current.aircraft_pool_high_water = lib_state.aircraft_pool.high_water;
+}
+
 void track_periodic_update()
 {
-    static uint64_t next_update;
-    uint64_t now = mstime();
+    uint64_t now, start;
+
+    if (lib_state.config.maintenance_budget)
+    {
+        track_maintenance_step();
+        return;
+    }
 
     // Only do updates once per second
-    if (now >= next_update)
+    now = mstime();
+    if (now >= track_next_update)
     {
-        next_update = now + 1000;
-        track_remove_stale_aircraft(now);
+        start = ustime();
+        track_next_update = now + 1000;
+        track_remove_stale_aircraft(now, UINT_MAX);
+        track_pool_stats();
+
         if (lib_state.config.mode_ac)
         {
-            track_match_ac(now);
+            track_match_ac_start();
+            track_match_ac(now, UINT_MAX);
         }
+        latency_hist_add(&lib_state.stats_current.latency_maintenance, ustime() - start);
+    }
+}
+
+void track_maintenance_step()
+{
+    uint64_t start = ustime();
+    uint64_t now = mstime();
+    unsigned budget = lib_state.config.maintenance_budget;
+    unsigned work;
+
+    if (now >= track_next_update)
+    {
+        track_next_update = now + 1000;
+        track_pool_stats();
+
+        if (lib_state.config.mode_ac)
+            track_match_ac_start();
     }
+
+    work = track_remove_stale_aircraft(now, budget);
+    if (work < budget)
+        track_match_ac(now, budget - work);
+
+    latency_hist_add(&lib_state.stats_current.latency_maintenance, ustime() - start);
 }